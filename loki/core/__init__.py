@@ -24,6 +24,8 @@
     :members:
 .. automodule:: loki.core.style
     :members:
+.. automodule:: loki.core.telemetry
+    :members:
 .. automodule:: loki.core.var
     :members:
 
@@ -0,0 +1,338 @@
+# encoding: utf-8
+"""
+loki.core.daemon
+~~~~~~~~~~~~~~~~
+
+Persistent local processing daemon for interactive sessions.
+
+By default every :func:`~loki.core.process.Processor.process` call
+forks a new worker pool, compiles/loads the LokiSelector classes in
+each worker and reopens every input file. The :class:`ProcessingDaemon`
+instead keeps a pool of warm workers alive between requests: the cpp
+classes are loaded once, and each worker keeps its recently used input
+files open (with their streamer info, tree headers, TTreeCache and
+already read baskets), so that edit-and-replot cycles on the same
+inputs skip the start-up cost.
+
+The daemon listens on a Unix socket (default: ``~/.lokicache/daemon.sock``,
+only accessible by the owner, and authenticated with a per-user key in
+``~/.lokicache/daemon.key``). Clients send batches of
+:class:`~loki.core.process.SelectorCfg`, and receive each processed
+selector as it finishes, together with the live progress of the workers.
+Requests are served one at a time.
+
+Start the daemon with ``loki daemon start`` and use it via
+``Processor(daemon=True)`` (or ``loki plot --daemon``). If the daemon
+can't be reached the Processor falls back to a local worker pool. The
+daemon must be restarted (``loki daemon stop``) to pick up changes of
+the cpp classes, or of input files that are rewritten in place with
+the same modification time.
+
+"""
+__author__    = "Will Davey"
+__email__     = "will.davey@cern.ch"
+__created__   = "2026-10-17"
+__copyright__ = "Copyright 2026 Will Davey"
+__license__   = "GPL http://www.gnu.org/licenses/gpl.html"
+
+
+## modules
+import os
+import time
+from multiprocessing import AuthenticationError, Pool, cpu_count
+from multiprocessing.connection import Listener, Client
+from loki.core import process
+from loki.core.helpers import mkdir_p
+from loki.core.logger import log
+
+
+# - - - - - - - - - - - class defs  - - - - - - - - - - - - #
+#------------------------------------------------------------------------------=buf=
+class ProcessingDaemon():
+    """Long-lived worker pool serving selector batches over a Unix socket
+
+    :param address: socket path (default: ``~/.lokicache/daemon.sock``)
+    :type address: str
+    :param ncores: number of worker processes (negative: all but `|n|` cores)
+    :type ncores: int
+    :param max_files: maximum number of input files kept open per worker
+    :type max_files: int
+    """
+    #: time [s] between progress updates sent to the client
+    update_interval = 0.5
+    #__________________________________________________________________________=buf=
+    def __init__(self, address=None, ncores=None, max_files=32):
+        # config
+        self.address = address or get_default_address()
+        if not ncores:     ncores = cpu_count()
+        elif ncores < 0:   ncores = max(1, cpu_count() + ncores)
+        self.ncores = min(ncores, cpu_count())
+        self.max_files = max_files
+
+        # members
+        self.pool = None
+        self.monitor = None
+        self.running = False
+        self.nrequests = 0
+        self.nselectors = 0
+        self.tstart = None
+
+    #__________________________________________________________________________=buf=
+    def serve(self):
+        """Start the worker pool and serve requests until stopped"""
+        if daemon_running(self.address):
+            log().error(f"Daemon already running on {self.address}")
+            return
+        if os.path.exists(self.address): os.remove(self.address)
+        mkdir_p(os.path.dirname(self.address))
+
+        # compile cpp classes before forking, so workers inherit them
+        process.load_cpp_classes()
+        self.monitor = process.ProgressMonitor(self.ncores)
+        self.pool = Pool(processes=self.ncores, initializer=init_daemon_worker,
+                         initargs=(self.monitor, self.max_files))
+
+        listener = Listener(self.address, family="AF_UNIX", authkey=get_authkey())
+        os.chmod(self.address, 0o600)
+        log().info(f"Loki daemon serving on {self.address} with {self.ncores} workers")
+        self.running = True
+        self.tstart = time.time()
+        try:
+            while self.running:
+                try:
+                    conn = listener.accept()
+                except Exception as e:
+                    log().warn(f"Rejected connection: {e}")
+                    continue
+                try:
+                    self.__handle__(conn)
+                except (EOFError, OSError):
+                    log().warn("Client disconnected")
+                finally:
+                    conn.close()
+        except KeyboardInterrupt:
+            pass
+        finally:
+            listener.close()
+            self.pool.terminate()
+            if os.path.exists(self.address): os.remove(self.address)
+            log().info("Loki daemon stopped")
+
+    #__________________________________________________________________________=buf=
+    def __handle__(self, conn):
+        """Handle single client request"""
+        (cmd, payload) = conn.recv()
+        if cmd == "status":
+            conn.send(("status", self.get_status()))
+        elif cmd == "stop":
+            self.running = False
+            conn.send(("status", self.get_status()))
+        elif cmd == "process":
+            self.__process__(conn, payload)
+        else:
+            conn.send(("error", f"Unknown command: {cmd}"))
+
+    #__________________________________________________________________________=buf=
+    def __process__(self, conn, selectors):
+        """Process batch of *selectors*, streaming results and progress to *conn*"""
+        self.nrequests += 1
+        self.nselectors += len(selectors)
+        log().info(f"Request {self.nrequests}: processing {len(selectors)} selectors")
+        results = dict([(i, self.pool.apply_async(process.process_selector, (s,)))
+                        for (i, s) in enumerate(selectors)])
+        while results:
+            for i in list(results):
+                r = results[i]
+                if not r.ready(): continue
+                try:
+                    msg = ("done", i, r.get())
+                except Exception as e:
+                    msg = ("error", i, repr(e))
+                conn.send(msg)
+                del results[i]
+            conn.send(("progress", None, list(self.monitor.data)))
+            if results: time.sleep(self.update_interval)
+
+    #__________________________________________________________________________=buf=
+    def get_status(self):
+        """Return dict with daemon status"""
+        return {"pid": os.getpid(), "ncores": self.ncores, "address": self.address,
+                "uptime": time.time() - self.tstart, "nrequests": self.nrequests,
+                "nselectors": self.nselectors, "busy": self.monitor.get_busy()}
+
+
+#------------------------------------------------------------------------------=buf=
+class DaemonClient():
+    """Client for the :class:`ProcessingDaemon`
+
+    :param address: socket path (default: ``~/.lokicache/daemon.sock``)
+    :type address: str
+    """
+    #__________________________________________________________________________=buf=
+    def __init__(self, address=None):
+        self.address = address or get_default_address()
+
+    #__________________________________________________________________________=buf=
+    def connect(self):
+        """Return new connection to the daemon"""
+        return Client(self.address, family="AF_UNIX", authkey=get_authkey())
+
+    #__________________________________________________________________________=buf=
+    def status(self):
+        """Return daemon status dict"""
+        return self.__request__("status")
+
+    #__________________________________________________________________________=buf=
+    def stop(self):
+        """Stop the daemon (after the current request), return final status"""
+        return self.__request__("stop")
+
+    #__________________________________________________________________________=buf=
+    def submit(self, selectors, ncores):
+        """Submit batch of *selectors*, return :class:`DaemonBatch`
+
+        :param selectors: selector configurations
+        :type selectors: list :class:`~loki.core.process.SelectorCfg`
+        :param ncores: number of daemon workers (see :func:`status`)
+        :type ncores: int
+        """
+        conn = self.connect()
+        conn.send(("process", selectors))
+        return DaemonBatch(conn, len(selectors), ncores)
+
+    #__________________________________________________________________________=buf=
+    def __request__(self, cmd):
+        """Send single command *cmd* and return reply payload"""
+        with self.connect() as conn:
+            conn.send((cmd, None))
+            (kind, payload) = conn.recv()
+        return payload
+
+
+#------------------------------------------------------------------------------=buf=
+class DaemonBatch(process.ProgressMonitor):
+    """Selector batch in progress on the :class:`ProcessingDaemon`
+
+    Stands in for both the worker pool and the progress monitor in
+    :func:`~loki.core.process.Processor.__process_selectors__`:
+    *results* behave like the pool's async results, and the progress
+    slots mirror the daemon's :class:`~loki.core.process.ProgressMonitor`.
+
+    :param conn: connection the batch was submitted on
+    :type conn: :class:`multiprocessing.connection.Connection`
+    :param njobs: number of submitted selectors
+    :type njobs: int
+    :param nslots: number of daemon workers
+    :type nslots: int
+    """
+    #__________________________________________________________________________=buf=
+    def __init__(self, conn, njobs, nslots):
+        self.conn = conn
+        self.nslots = nslots
+        self.data = [0.] * (nslots * self.nfields)
+        self.stalled = set()
+        self.results = [DaemonResult(self) for i in range(njobs)]
+
+    #__________________________________________________________________________=buf=
+    def poll(self):
+        """Read all pending messages from the daemon"""
+        while self.conn and self.conn.poll(0):
+            try:
+                (kind, i, payload) = self.conn.recv()
+            except EOFError:
+                self.__abort__("Lost connection to daemon")
+                return
+            if kind == "done":       self.results[i].set(payload)
+            elif kind == "error":    self.results[i].set(None, payload)
+            elif kind == "progress": 
+                self.data = payload
+                self.nslots = len(payload) // self.nfields
+
+    #__________________________________________________________________________=buf=
+    def get_entries(self):
+        """Return total number of entries processed by running jobs"""
+        self.poll()
+        return process.ProgressMonitor.get_entries(self)
+
+    #__________________________________________________________________________=buf=
+    def close(self):
+        """Close connection (pool interface)"""
+        if self.conn: self.conn.close()
+        self.conn = None
+
+    #__________________________________________________________________________=buf=
+    def __abort__(self, msg):
+        """Fail all outstanding results with *msg*"""
+        for r in self.results:
+            if not r.done: r.set(None, msg)
+        self.close()
+
+
+#------------------------------------------------------------------------------=buf=
+class DaemonResult():
+    """Result of a single selector in a :class:`DaemonBatch` (async result interface)"""
+    #__________________________________________________________________________=buf=
+    def __init__(self, batch):
+        self.batch = batch
+        self.done = False
+        self.value = None
+        self.error = None
+
+    #__________________________________________________________________________=buf=
+    def set(self, value, error=None):
+        """Set result *value* (or *error*)"""
+        self.done = True
+        self.value = value
+        self.error = error
+
+    #__________________________________________________________________________=buf=
+    def ready(self):
+        """Return True if the result has arrived"""
+        if not self.done: self.batch.poll()
+        return self.done
+
+    #__________________________________________________________________________=buf=
+    def get(self):
+        """Return the processed selector config (raises on worker failure)"""
+        if self.error: raise RuntimeError(f"Daemon job failed: {self.error}")
+        return self.value
+
+
+# - - - - - - - - - - - - - - - function defs - - - - - - - - - - - - - - - - #
+#______________________________________________________________________________=buf=
+def get_default_address():
+    """Return default daemon socket path"""
+    return os.path.join(os.getenv('HOME'), ".lokicache", "daemon.sock")
+
+
+#______________________________________________________________________________=buf=
+def get_authkey():
+    """Return per-user daemon authentication key (created on first use)"""
+    fname = os.path.join(os.getenv('HOME'), ".lokicache", "daemon.key")
+    if not os.path.exists(fname):
+        mkdir_p(os.path.dirname(fname))
+        fd = os.open(fname, os.O_WRONLY | os.O_CREAT | os.O_EXCL, 0o600)
+        with os.fdopen(fd, "wb") as f:
+            f.write(os.urandom(32))
+    with open(fname, "rb") as f:
+        return f.read()
+
+
+#______________________________________________________________________________=buf=
+def daemon_running(address=None):
+    """Return True if a daemon is listening on *address*"""
+    try:
+        DaemonClient(address).status()
+        return True
+    except (OSError, EOFError, AuthenticationError):
+        return False
+
+
+#______________________________________________________________________________=buf=
+def init_daemon_worker(monitor, max_files):
+    """Initialize daemon worker: claim progress slot and keep input files open"""
+    process.init_worker(monitor)
+    process.keep_input_files(max_files)
+
+
+## EOF
@@ -0,0 +1,563 @@
+# encoding: utf-8
+"""
+loki.core.executor
+~~~~~~~~~~~~~~~~~~
+
+Executor backends running the :class:`~loki.core.process.Processor`
+selectors as standalone jobs, for campaign-scale processing over many
+thousands of input files.
+
+The selectors are grouped into jobs of similar estimated cost (events x
+booked hists, see :func:`group_selectors`), written to a job spec (see
+:func:`~loki.core.process.write_job_spec`) in a work dir on a shared
+filesystem, and run by the standalone executor (``lokirun``, built by
+scripts/build_lokirun.sh) via scripts/batch_lokirun.sh. Each job writes
+its selector outputs, the selector statistics and a completion marker
+to the work dir, from which the Processor caches and merges the results
+as for the local worker pool.
+
+Two backends are provided:
+
+* :class:`BatchExecutor`: submits the jobs as a single job array to a
+  PBS or HTCondor batch system
+* :class:`LocalExecutor`: runs the same job script as local subprocesses,
+  behaving like the batch backend (eg. for testing)
+
+Use via ``Processor(executor=...)`` (or ``loki plot --executor``).
+
+"""
+__author__    = "Will Davey"
+__email__     = "will.davey@cern.ch"
+__created__   = "2026-10-17"
+__copyright__ = "Copyright 2026 Will Davey"
+__license__   = "GPL http://www.gnu.org/licenses/gpl.html"
+
+
+## modules
+import heapq
+import json
+import math
+import os
+import re
+import subprocess
+import tempfile
+import time
+from multiprocessing import cpu_count
+from loki.core import process
+from loki.core.helpers import mkdir_p
+from loki.core.logger import log
+from loki.core.telemetry import now
+from loki.utils.system import get_project_path
+
+
+# - - - - - - - - - - - class defs  - - - - - - - - - - - - #
+#------------------------------------------------------------------------------=buf=
+class Executor():
+    """Base class for the executor backends
+
+    Implementations provide :func:`__launch__` (start the jobs of a batch)
+    and optionally :func:`__update__` (called on every poll).
+
+    :param workdir: shared dir for job specs, logs and outputs (default: ``~/.lokicache/jobs``)
+    :type workdir: str
+    :param job_cost: target cost per job (events x (booked hists + 1))
+    :type job_cost: float
+    :param max_jobs: maximum number of jobs per batch
+    :type max_jobs: int
+    """
+    #: time [s] between checks for finished jobs
+    poll_interval = 5.
+    #__________________________________________________________________________=buf=
+    def __init__(self, workdir=None, job_cost=2.e8, max_jobs=None):
+        self.workdir = os.path.abspath(workdir or get_default_workdir())
+        self.job_cost = job_cost
+        self.max_jobs = max_jobs
+        #: number of concurrently running jobs
+        self.ncores = 1
+        #: minimum number of jobs per batch
+        self.min_jobs = 1
+
+    #__________________________________________________________________________=buf=
+    def get_njobs(self, selectors):
+        """Return number of jobs for *selectors* (from their total estimated cost)"""
+        cost = sum([selector_cost(s) for s in selectors])
+        njobs = max(int(math.ceil(cost / self.job_cost)), self.min_jobs)
+        if self.max_jobs: njobs = min(njobs, self.max_jobs)
+        return max(1, min(njobs, len(selectors)))
+
+    #__________________________________________________________________________=buf=
+    def submit(self, selectors, ncores=None):
+        """Submit *selectors*, return :class:`ExecutorBatch`
+
+        :param selectors: selector configurations (outputs must be on the shared filesystem)
+        :type selectors: list :class:`~loki.core.process.SelectorCfg`
+        :param ncores: unused (pool interface, see :attr:`ncores`)
+        :type ncores: int
+        """
+        lokirun = process.get_lokirun_path()
+        if not os.path.exists(lokirun):
+            raise RuntimeError(f"Standalone executor {lokirun} not found, build with scripts/build_lokirun.sh")
+        mkdir_p(self.workdir)
+        jobdir = tempfile.mkdtemp(prefix="batch_", dir=self.workdir)
+
+        # write job spec and index (selectors per job)
+        jobs = group_selectors(selectors, self.get_njobs(selectors))
+        fspec = os.path.join(jobdir, "spec.json")
+        process.write_job_spec(selectors, fspec)
+        findex = os.path.join(jobdir, "jobs.index")
+        with open(findex, "w") as f:
+            for job in jobs: f.write(" ".join([str(i) for i in job]) + "\n")
+
+        # unleash
+        env = {"LOKIRUN": lokirun, "JOBSPEC": fspec, "JOBINDEX": findex, "JOBDIR": jobdir}
+        log().info(f"Submitting {len(selectors)} selectors in {len(jobs)} jobs, work dir: {jobdir}")
+        batch = ExecutorBatch(self, selectors, jobs, jobdir, env)
+        self.__launch__(batch)
+        return batch
+
+    #__________________________________________________________________________=buf=
+    def __launch__(self, batch):
+        """Start the jobs of *batch*"""
+        raise NotImplementedError
+
+    #__________________________________________________________________________=buf=
+    def __update__(self, batch):
+        """Called on every poll of *batch*"""
+        pass
+
+
+#------------------------------------------------------------------------------=buf=
+class LocalExecutor(Executor):
+    """Executor running the jobs as local subprocesses
+
+    Runs the same job script as the :class:`BatchExecutor`, with at most
+    *ncores* jobs at a time. The selectors are split into at least
+    *ncores* jobs.
+
+    :param ncores: number of concurrent jobs (negative: all but `|n|` cores)
+    :type ncores: int
+    :param kw: see :class:`Executor`
+    """
+    poll_interval = 1.
+    #__________________________________________________________________________=buf=
+    def __init__(self, ncores=None, **kw):
+        Executor.__init__(self, **kw)
+        if not ncores:     ncores = cpu_count()
+        elif ncores < 0:   ncores = max(1, cpu_count() + ncores)
+        self.ncores = self.min_jobs = ncores
+
+    #__________________________________________________________________________=buf=
+    def __launch__(self, batch):
+        """Queue the jobs of *batch*, start the first *ncores*"""
+        batch.queue = list(range(len(batch.jobs)))
+        self.__update__(batch)
+
+    #__________________________________________________________________________=buf=
+    def __update__(self, batch):
+        """Start queued jobs of *batch* while slots are free"""
+        nrunning = 0
+        for (ijob, p) in batch.procs.items():
+            if p.poll() is None: 
+                nrunning += 1
+            # mark jobs that died before completing
+            elif not os.path.exists(batch.get_prefix(ijob) + ".done"): 
+                with open(batch.get_prefix(ijob) + ".done", "w") as f:
+                    f.write(f"{p.returncode}\n")
+        while batch.queue and nrunning < self.ncores:
+            ijob = batch.queue.pop(0)
+            with open(batch.get_prefix(ijob) + ".log", "w") as flog:
+                batch.procs[ijob] = subprocess.Popen(["bash", get_job_script(), str(ijob)],
+                                                     env=dict(os.environ, **batch.env),
+                                                     stdout=flog, stderr=subprocess.STDOUT,
+                                                     stdin=subprocess.DEVNULL)
+            nrunning += 1
+
+
+#------------------------------------------------------------------------------=buf=
+class BatchExecutor(Executor):
+    """Executor submitting the jobs as a job array to a batch system
+
+    The work dir must be on a filesystem shared with the worker nodes,
+    which run the loki setup (setup.sh) before the job.
+
+    Jobs that the batch system loses (killed for walltime or memory, node
+    failure, removed or held) never write their completion marker. The
+    array is therefore checked every *check_interval* seconds (qstat or
+    condor_q), and jobs that have been missing from the queue for more
+    than *lost_grace* seconds without a marker are marked as failed. If
+    *timeout* is set, jobs running for longer than *timeout* seconds
+    (since their start marker) are also marked as failed.
+
+    :param system: batch system ("pbs" or "condor")
+    :type system: str
+    :param queue: PBS queue (default: medium) or HTCondor job flavour
+    :type queue: str
+    :param max_jobs: maximum number of jobs per batch
+    :type max_jobs: int
+    :param timeout: maximum job run time [s] (default: no limit)
+    :type timeout: float
+    :param kw: see :class:`Executor`
+    """
+    poll_interval = 10.
+    check_interval = 60.
+    lost_grace = 120.
+    #__________________________________________________________________________=buf=
+    def __init__(self, system="pbs", queue=None, max_jobs=1000, timeout=None, **kw):
+        Executor.__init__(self, max_jobs=max_jobs, **kw)
+        if system not in ["pbs", "condor"]:
+            raise ValueError(f"Unknown batch system: {system}")
+        self.system = system
+        self.queue = queue
+        self.timeout = timeout
+        self.ncores = max_jobs
+
+    #__________________________________________________________________________=buf=
+    def __launch__(self, batch):
+        """Submit the jobs of *batch* as job array"""
+        njobs = len(batch.jobs)
+        name = f"loki-run-{os.path.basename(batch.jobdir)}"
+        env = dict(batch.env, LOKIDIR=get_project_path(), LOKISETUP="1")
+        if self.system == "pbs":
+            cmdargs = ["qsub",
+                       "-d", batch.jobdir,
+                       "-o", batch.jobdir,
+                       "-N", name,
+                       "-t", f"0-{njobs-1}",
+                       "-q", self.queue or "medium",
+                       "-v", ",".join([f"{k}={v}" for (k, v) in env.items()]),
+                       get_job_script()]
+        else:
+            fsub = os.path.join(batch.jobdir, "jobs.sub")
+            with open(fsub, "w") as f:
+                f.write(f"executable  = {get_job_script()}\n")
+                f.write("arguments   = $(Process)\n")
+                f.write(f"initialdir  = {batch.jobdir}\n")
+                f.write("output      = job_$(Process).log\n")
+                f.write("error       = job_$(Process).err\n")
+                f.write("log         = jobs.condor.log\n")
+                f.write(f"batch_name  = {name}\n")
+                f.write(f"environment = \"{' '.join([f'{k}={v}' for (k, v) in env.items()])}\"\n")
+                if self.queue: f.write(f"+JobFlavour = \"{self.queue}\"\n")
+                f.write(f"queue {njobs}\n")
+            cmdargs = ["condor_submit", fsub]
+        result = subprocess.run(cmdargs, stdout=subprocess.PIPE, universal_newlines=True)
+        if result.returncode != 0:
+            raise RuntimeError(f"Job submission failed ({cmdargs[0]} returned {result.returncode})")
+        log().info(result.stdout.strip())
+        batch.arrayid = get_array_id(self.system, result.stdout)
+        if batch.arrayid is None:
+            log().warn("Couldn't determine job array id, lost jobs won't be detected")
+
+    #__________________________________________________________________________=buf=
+    def __update__(self, batch):
+        """Mark jobs of *batch* that were lost by the batch system (or timed out) as failed"""
+        t = time.time()
+        if t - batch.tcheck < self.check_interval: return
+        batch.tcheck = t
+        active = self.__get_active__(batch)
+        for ijob in sorted(batch.pending):
+            prefix = batch.get_prefix(ijob)
+            if os.path.exists(prefix + ".done"): continue
+            reason = None
+            if active is not None and ijob not in active:
+                tlost = batch.lost.setdefault(ijob, t)
+                if t - tlost > self.lost_grace: reason = "lost"
+            else:
+                batch.lost.pop(ijob, None)
+            if (self.timeout and os.path.exists(prefix + ".start")
+                    and t - os.path.getmtime(prefix + ".start") > self.timeout):
+                reason = "timeout"
+            if reason:
+                log().warn(f"Job {ijob} failed ({reason}), marking as done")
+                with open(prefix + ".done", "w") as f:
+                    f.write(f"{reason}\n")
+
+    #__________________________________________________________________________=buf=
+    def __get_active__(self, batch):
+        """Return indices of the jobs of *batch* that are queued or running 
+        (None if the batch system can't be queried)"""
+        if batch.arrayid is None: return None
+        if self.system == "pbs":
+            cmdargs = ["qstat", "-t", batch.arrayid]
+        else:
+            cmdargs = ["condor_q", batch.arrayid, "-af", "ProcId", "JobStatus"]
+        try:
+            result = subprocess.run(cmdargs, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                                    universal_newlines=True, timeout=60)
+        except (OSError, subprocess.TimeoutExpired) as e:
+            log().debug(f"Failed to query batch system: {e}")
+            return None
+        if result.returncode != 0:
+            # finished arrays are no longer known to qstat
+            if "Unknown Job" in result.stderr: return set()
+            log().debug(f"Failed to query batch system: {result.stderr.strip()}")
+            return None
+        if self.system == "pbs": return parse_qstat(result.stdout)
+        return parse_condor_q(result.stdout)
+
+
+#------------------------------------------------------------------------------=buf=
+class ExecutorBatch(process.ProgressMonitor):
+    """Selector batch in progress on an :class:`Executor`
+
+    Stands in for both the worker pool and the progress monitor in
+    :func:`~loki.core.process.Processor.__process_selectors__` (like the
+    :class:`~loki.core.daemon.DaemonBatch`): *results* behave like the
+    pool's async results. The jobs don't report live progress, so only
+    the number of running jobs is shown.
+
+    :param executor: executor running the batch
+    :type executor: :class:`Executor`
+    :param selectors: submitted selectors
+    :type selectors: list :class:`~loki.core.process.SelectorCfg`
+    :param jobs: selector indices for each job
+    :type jobs: list list int
+    :param jobdir: shared dir of the batch
+    :type jobdir: str
+    :param env: job environment
+    :type env: dict
+    """
+    #__________________________________________________________________________=buf=
+    def __init__(self, executor, selectors, jobs, jobdir, env):
+        self.executor = executor
+        self.selectors = selectors
+        self.jobs = jobs
+        self.jobdir = jobdir
+        self.env = env
+        self.nslots = 0
+        self.data = []
+        self.stalled = set()
+        self.results = [ExecutorResult(self) for s in selectors]
+        self.pending = set(range(len(jobs)))
+        self.nbusy = 0
+        self.tpoll = 0.
+        # batch system job array (see :class:`BatchExecutor`)
+        self.arrayid = None
+        self.tcheck = 0.
+        self.lost = dict()
+        # local subprocesses (see :class:`LocalExecutor`)
+        self.procs = dict()
+        self.queue = []
+
+    #__________________________________________________________________________=buf=
+    def get_prefix(self, ijob):
+        """Return path prefix of the log, stats and marker files of job *ijob*"""
+        return os.path.join(self.jobdir, f"job_{ijob}")
+
+    #__________________________________________________________________________=buf=
+    def poll(self):
+        """Collect finished jobs (at most every *poll_interval* seconds)"""
+        if time.time() - self.tpoll < self.executor.poll_interval: return
+        self.tpoll = time.time()
+        self.executor.__update__(self)
+        for ijob in sorted(self.pending):
+            if os.path.exists(self.get_prefix(ijob) + ".done"):
+                self.__collect__(ijob)
+                self.pending.discard(ijob)
+        self.nbusy = sum([1 for ijob in self.pending
+                          if os.path.exists(self.get_prefix(ijob) + ".start")])
+
+    #__________________________________________________________________________=buf=
+    def __collect__(self, ijob):
+        """Set results for the selectors of finished job *ijob*"""
+        prefix = self.get_prefix(ijob)
+        with open(prefix + ".done") as f:
+            status = f.read().strip()
+        # selector stats (one json line per successful selector)
+        stats = dict()
+        if os.path.exists(prefix + ".out"):
+            with open(prefix + ".out") as f:
+                for line in f:
+                    try:
+                        d = json.loads(line)
+                    except ValueError:
+                        continue
+                    stats[d.get("fout")] = d
+        for i in self.jobs[ijob]:
+            scfg = self.selectors[i]
+            d = stats.get(scfg.fout)
+            if d is None:
+                self.results[i].set(None, f"job {ijob} failed with status {status} (see {prefix}.log)")
+                continue
+            # convert to worker stats format (job index as trace lane)
+            dur = d.pop("time", 0.) * 1.e6
+            d.update(ts=now() - dur, dur=dur, pid=ijob, fin=scfg.fin)
+            scfg.stats = d
+            self.results[i].set(scfg)
+
+    #__________________________________________________________________________=buf=
+    def get_entries(self):
+        """Return total number of entries processed by running jobs (not reported)"""
+        self.poll()
+        return 0
+
+    #__________________________________________________________________________=buf=
+    def get_bytes(self):
+        """Return total number of bytes read by running jobs (not reported)"""
+        return 0
+
+    #__________________________________________________________________________=buf=
+    def get_rss(self):
+        """Return largest resident set size of running jobs (not reported)"""
+        return 0.
+
+    #__________________________________________________________________________=buf=
+    def get_busy(self):
+        """Return number of running jobs"""
+        return self.nbusy
+
+    #__________________________________________________________________________=buf=
+    def get_new_stalls(self, stall_time):
+        """Return list of newly stalled slots (not monitored)"""
+        return []
+
+    #__________________________________________________________________________=buf=
+    def close(self):
+        """Wait for local subprocesses (pool interface)"""
+        for p in self.procs.values(): p.wait()
+        self.procs = dict()
+
+
+#------------------------------------------------------------------------------=buf=
+class ExecutorResult():
+    """Result of a single selector in an :class:`ExecutorBatch` (async result interface)"""
+    #__________________________________________________________________________=buf=
+    def __init__(self, batch):
+        self.batch = batch
+        self.done = False
+        self.value = None
+        self.error = None
+
+    #__________________________________________________________________________=buf=
+    def set(self, value, error=None):
+        """Set result *value* (or *error*)"""
+        self.done = True
+        self.value = value
+        self.error = error
+
+    #__________________________________________________________________________=buf=
+    def ready(self):
+        """Return True if the job of the selector has finished"""
+        if not self.done: self.batch.poll()
+        return self.done
+
+    #__________________________________________________________________________=buf=
+    def get(self):
+        """Return the processed selector config (raises on job failure)"""
+        if self.error: raise RuntimeError(f"Executor job failed: {self.error}")
+        return self.value
+
+
+# - - - - - - - - - - - - - - - function defs - - - - - - - - - - - - - - - - #
+#______________________________________________________________________________=buf=
+def get_executor(name, ncores=None, queue=None, workdir=None):
+    """Return executor backend by *name* ("local", "pbs" or "condor")
+
+    :param name: backend name
+    :type name: str
+    :param ncores: number of concurrent jobs (local only)
+    :type ncores: int
+    :param queue: batch queue (batch only)
+    :type queue: str
+    :param workdir: shared work dir
+    :type workdir: str
+    """
+    if name == "local":
+        return LocalExecutor(ncores=ncores, workdir=workdir)
+    return BatchExecutor(system=name, queue=queue, workdir=workdir)
+
+
+#______________________________________________________________________________=buf=
+def get_default_workdir():
+    """Return default executor work dir"""
+    return os.path.join(os.getenv('HOME'), ".lokicache", "jobs")
+
+
+#______________________________________________________________________________=buf=
+def get_job_script():
+    """Return path of the job script"""
+    return os.path.join(get_project_path(), "scripts", "batch_lokirun.sh")
+
+
+#______________________________________________________________________________=buf=
+def selector_cost(scfg):
+    """Return estimated processing cost of selector *scfg*
+
+    The cost is the number of events times the number of booked hists
+    and ntuple variables (+1 for reading the events).
+    """
+    nbook = len(scfg.hists) + sum([len(n.names) for n in scfg.ntups])
+    return max(1, scfg.nevents or 0) * (1 + nbook)
+
+
+#______________________________________________________________________________=buf=
+def group_selectors(selectors, njobs):
+    """Return selector indices grouped into *njobs* jobs of similar cost
+
+    The selectors are assigned in order of decreasing cost, each to the
+    job with the lowest total cost so far.
+
+    :param selectors: selector configurations
+    :type selectors: list :class:`~loki.core.process.SelectorCfg`
+    :param njobs: number of jobs
+    :type njobs: int
+    :rtype: list list int
+    """
+    njobs = max(1, min(njobs, len(selectors)))
+    heap = [(0, j) for j in range(njobs)]
+    jobs = [[] for j in range(njobs)]
+    order = sorted(range(len(selectors)), key=lambda i: -selector_cost(selectors[i]))
+    for i in order:
+        (cost, j) = heapq.heappop(heap)
+        jobs[j].append(i)
+        heapq.heappush(heap, (cost + selector_cost(selectors[i]), j))
+    return [sorted(job) for job in jobs if job]
+
+
+
+#______________________________________________________________________________=buf=
+def get_array_id(system, text):
+    """Return job array id from the submission output *text* (None if not found)
+
+    :param system: batch system ("pbs" or "condor")
+    :type system: str
+    :param text: output of qsub or condor_submit
+    :type text: str
+    :rtype: str
+    """
+    if system == "pbs":
+        # eg. "1234[].server"
+        lines = [l.strip() for l in text.splitlines() if "[" in l]
+        return lines[-1] if lines else None
+    # eg. "10 job(s) submitted to cluster 1234."
+    m = re.search(r"submitted to cluster (\d+)", text)
+    return m.group(1) if m else None
+
+
+#______________________________________________________________________________=buf=
+def parse_qstat(text):
+    """Return indices of the queued or running sub-jobs in the output of ``qstat -t``"""
+    active = set()
+    for line in text.splitlines():
+        # job id, name, user, time, state, queue
+        fields = line.split()
+        m = re.match(r"\d+\[(\d+)\]", fields[0]) if fields else None
+        if m and len(fields) >= 5 and fields[4] not in ["C", "E", "F", "X"]:
+            active.add(int(m.group(1)))
+    return active
+
+
+#______________________________________________________________________________=buf=
+def parse_condor_q(text):
+    """Return indices of the queued or running jobs in the output of 
+    ``condor_q -af ProcId JobStatus`` (held, removed and completed jobs 
+    are not active)"""
+    active = set()
+    for line in text.splitlines():
+        fields = line.split()
+        if len(fields) == 2 and fields[1] in ["1", "2", "6", "7"]:
+            active.add(int(fields[0]))
+    return active
+
+
+## EOF
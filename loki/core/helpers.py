@@ -34,12 +34,14 @@ class ProgressBar():
         self.width = width or 40
 
     #____________________________________________________________
-    def update(self,n):
+    def update(self,n,info=None):
         """
         prints a progress bar
+
+        optional *info* text (eg. rate, ETA) is appended to the bar
         """
         bar = f'[%-{self.width}s] %.f%%'
-        frac = float(n)/float(self.ntotal)
+        frac = min(1., float(n)/float(self.ntotal)) if self.ntotal else 1.
 
         sys.stdout.write('\r')
         # the exact output you're looking for:
@@ -48,7 +50,9 @@ class ProgressBar():
         if self.text is not None:
             line+='%-17s:  '%(str(self.text)[:20])
         line+=bar % ('='*inc, frac*100.)
+        if info: line+=f'  {info}'
         line+=enums.UNSET
+        line+='\033[K' # clear rest of line
         sys.stdout.write(line)
         sys.stdout.flush()
 
@@ -15,14 +15,35 @@ __license__   = "GPL http://www.gnu.org/licenses/gpl.html"
 
 
 ## modules
+import functools
+import numpy as np
 import ROOT
 from loki.core.histutils import make_eff, get_profile, integral, normalize
 from loki.core.histutils import full_integral, create_roc_graph, divide_graphs
-from loki.core.histutils import divide_hists, histargs
+from loki.core.histutils import divide_hists, histargs, bin_contents, bin_sumw2
 from loki.core.logger import log
 from loki.core.style import default_style
 from loki.common.vars import dummyvar, effvar
 
+# - - - - - - - - - - - - - - - function defs - - - - - - - - - - - - - - - - #
+#____________________________________________________________
+def memoised_build(build):
+    """Wrap *build_rootobj* implementation for memoised, dependency-aware builds
+    
+    The inputs (:func:`RootDrawable.get_inputs`) are built first, and 
+    the wrapped build is skipped if the object was already built and 
+    neither the object itself nor any input changed since.
+    """
+    @functools.wraps(build)
+    def wrapper(self):
+        for rd in self.get_inputs(): rd.build_rootobj()
+        if self._rootobj is not None and self._build_key == self.get_build_key(): 
+            return
+        build(self)
+        self._build_key = self.get_build_key()
+    return wrapper
+
+
 # - - - - - - - - - - - class defs  - - - - - - - - - - - - #
 
 #------------------------------------------------------------
@@ -44,6 +65,19 @@ class RootDrawable():
     If *yvar* (*zvar*) is specified, will function as a 2D (3D) object. 
     The y-axis range will be set to the yvar range when drawing.
     
+    Memoised builds: the drawables form a DAG, where the inputs of each 
+    node are given by ``get_inputs`` (by default the sub-drawables). 
+    ``build_rootobj`` is automatically wrapped (see :func:`memoised_build`) 
+    so that the inputs are built first and the object is only rebuilt 
+    if its own ROOT object was replaced (``set_rootobj``, eg. when the 
+    component hists are re-merged) or any of its inputs changed since 
+    the last build. Shared inputs are therefore built exactly once, and 
+    downstream objects are only invalidated when an input changes. 
+
+    Drawables booked on a lazy :class:`~loki.core.process.Processor` 
+    are marked as pending, and accessing their ROOT object triggers 
+    the deferred processing (see :func:`resolve`). 
+    
     :param xvar: x-axis variable view
     :type xvar: :class:`loki.core.var.View`
     :param yvar: y-axis variable view
@@ -78,6 +112,16 @@ class RootDrawable():
         self._rootobj = None
         self._subrds = []
         self._extra_labels = []
+        self._version = 0
+        self._build_key = None
+        self._pending = None
+
+    #____________________________________________________________
+    def __init_subclass__(cls, **kwargs):
+        """Wrap *build_rootobj* of derived classes in :func:`memoised_build`"""
+        super().__init_subclass__(**kwargs)
+        if "build_rootobj" in cls.__dict__: 
+            cls.build_rootobj = memoised_build(cls.__dict__["build_rootobj"])
 
     #____________________________________________________________
     def draw(self):
@@ -90,6 +134,7 @@ class RootDrawable():
         elif self.drawopt: 
             drawopts += [str(self.drawopt)]
         # check for _rootobj
+        self.resolve()
         if not self._rootobj: 
             log().warn(f"{self.name} trying to draw null rootobj! Skipping...")
             return None
@@ -102,6 +147,7 @@ class RootDrawable():
         """Returns the raw ROOT drawable object 
         :rtype: :class:`ROOT.TH1` or :class:`ROOT.TGraph` (or derivatives)
         """
+        self.resolve()
         return self._rootobj
 
     #____________________________________________________________
@@ -116,12 +162,38 @@ class RootDrawable():
             return
         if self.sty: self.sty.apply(o)
         self._rootobj = o
+        self._version += 1
 
     #____________________________________________________________
     def is_valid(self):
         """Returns true if rootobj is valid (not None)"""
+        self.resolve()
         return (self._rootobj is not None)
 
+    #____________________________________________________________
+    def resolve(self):
+        """Run pending processing if booked on a lazy processor"""
+        if self._pending is not None: 
+            self._pending.run()
+
+    #____________________________________________________________
+    def get_inputs(self):
+        """Return the drawables this object is built from (default: sub-drawables)
+        
+        :rtype: list :class:`RootDrawable`
+        """
+        return self._subrds
+
+    #____________________________________________________________
+    def invalidate(self):
+        """Force rebuild on next call to *build_rootobj*"""
+        self._build_key = None
+
+    #____________________________________________________________
+    def get_build_key(self):
+        """Return state (versions of self and inputs) the build depends on"""
+        return (self._version,) + tuple([rd._version for rd in self.get_inputs()])
+
     #____________________________________________________________
     def add_subrd(self,rd):
         """Declare sub drawable object
@@ -235,6 +307,8 @@ class Hist(RootDrawable):
         self.sel = sel
         self.weight = weight
         self.normalize = normalize
+        # (key, role) if hist is the pass/total component of an efficiency
+        self.eff = None
     
         if (yvar and not xvar) or (zvar and not (xvar and yvar)): 
             log().warn(f"Malformed hist: {self.name}")
@@ -303,11 +377,15 @@ class HistProxy(RootDrawable):
         allowed_ops = ['+', '-', '*', '/']
         assert op in allowed_ops, f"HistProxy invalid operator: {op}, must be in {allowed_ops}"
 
+    # ____________________________________________________________
+    def get_inputs(self):
+        """Return input hists"""
+        return self.hists
+
     # ____________________________________________________________
     def build_rootobj(self):
         """Build the ratio graph"""
-        # process inputs
-        for h in self.hists: h.build_rootobj()
+        # inputs are built by memoised_build
         #if self.owner:
         #    # if owner, need to explicitly build the root objects
         #    for h in self.hists: h.build_rootobj()
@@ -423,6 +501,15 @@ class EffProfile(RootDrawable):
     over truth objects (truth taus in the denominator and reco taus 
     in the numerator).  
     
+    If the numerator and denominator share the same variable, the 
+    numerator selection is *sel_pass* & *sel_total* (ie. *sel_pass* 
+    is treated as a subset of *sel_total*, as it should be for an 
+    efficiency), and the :class:`~loki.core.process.Processor` fills 
+    both hists together with a native efficiency accumulator (LokiEff), 
+    which evaluates the variable and weight only once per entry. The 
+    numerator has the same meaning (and cache hash) whether or not it 
+    is filled by LokiEff. 
+    
     :param sample: input event sample
     :type sample: :class:`loki.core.sample.Sample`
     :param xvar: x-axis variable view
@@ -448,11 +535,18 @@ class EffProfile(RootDrawable):
         RootDrawable.__init__(self,xvar=xvar,sty=sty or sample.sty,
                               drawopt="P,E1",**kwargs)
         if xvar_total is None: xvar_total = xvar
+        # numerator is a subset of the denominator (see LokiEff)
+        if xvar_total.var == xvar.var and sel_pass and sel_total: 
+            sel_pass = sel_pass & sel_total
         # members
         self.h_pass  = Hist(sample=sample, xvar=xvar,       sel=sel_pass,  weight=weight, name=f"{self.name}Pass")
         self.h_total = Hist(sample=sample, xvar=xvar_total, sel=sel_total, weight=weight ,name=f"{self.name}Total")
         self.add_subrd(self.h_pass)
         self.add_subrd(self.h_total)
+        # tag components for the native efficiency accumulator
+        key = f"{self.name}:{id(self)}"
+        self.h_pass.eff = (key, "pass")
+        self.h_total.eff = (key, "total")
  
     #____________________________________________________________
     def build_rootobj(self):
@@ -744,36 +838,23 @@ class MigrationMatrix(RootDrawable):
         h.SetMinimum(0.)
         h.SetMaximum(100.)
         
+        # bin content and error views (in-range bins)
+        sumw2 = bin_sumw2(h, create=True)[1:-1,1:-1]
+        n = bin_contents(h)[1:-1,1:-1]
+        
         # diagonal fraction
         if h.Integral():
             size = min(h.GetNbinsX(),h.GetNbinsY())
-            diag = sum([h.GetBinContent(i+1,i+1) for i in range(size)])
-            tot  = sum([h.GetBinContent(i+1,j+1) for i in range(size) for j in range(size)])
+            diag = np.trace(n[:size,:size])
+            tot  = n[:size,:size].sum()
             if tot: 
                 self.diagonal = diag / tot * 100.0 
         
-        if self.rownorm:
-            for iy in range(1,h.GetNbinsY()+1):
-                total = sum([h.GetBinContent(ix,iy) for ix in range(1,h.GetNbinsX()+1)])
-                for ix in range(1,h.GetNbinsX()+1):
-                    if not total: 
-                        n = en = 0.0
-                    else:
-                        n = h.GetBinContent(ix,iy) / total * 100.0
-                        en = h.GetBinError(ix,iy) / total * 100.0
-                    h.SetBinContent(ix,iy,n)
-                    h.SetBinError(ix,iy,en)
-        else:
-            for ix in range(1,h.GetNbinsX()+1):
-                total = sum([h.GetBinContent(ix,iy) for iy in range(1,h.GetNbinsY()+1)])
-                for iy in range(1,h.GetNbinsY()+1):
-                    if not total: 
-                        n = en = 0.0
-                    else:
-                        n = h.GetBinContent(ix,iy) / total * 100.0
-                        en = h.GetBinError(ix,iy) / total * 100.0
-                    h.SetBinContent(ix,iy,n)
-                    h.SetBinError(ix,iy,en)
+        # normalise rows (sum over x) or columns (sum over y) to 100%
+        total = n.sum(axis=0 if self.rownorm else 1, keepdims=True)
+        scale = np.divide(100.0, total, out=np.zeros_like(total), where=total != 0)
+        n *= scale
+        sumw2 *= scale**2
 
         # build extra labels
         self._extra_labels += [f"Diagonal: {self.diagonal:.1f}%"]
@@ -819,24 +900,20 @@ class Ratio(RootDrawable):
         if owner: 
             self.add_subrd(rd_num)
             self.add_subrd(rd_den)
+
+    #____________________________________________________________
+    def get_inputs(self):
+        """Return numerator and denominator (also if not owned)"""
+        return [self.rd_num, self.rd_den]
  
     #____________________________________________________________
     def build_rootobj(self):
         """Build the ratio graph"""
-        # process inputs
-        if self.owner: 
-            # if owner, need to explicitly build the root objects
-            self.rd_num.build_rootobj()
-            self.rd_den.build_rootobj()
-        else:
-            # otherwise they should have been built prior
-            # TODO: can break if order wrong, implement job sequence awareness?
-            if not self.rd_num.is_valid(): 
-                log().error("Inputs for Ratio not available, make sure they're scheduled")
-                return
-            if not self.rd_den.is_valid(): 
-                log().error("Inputs for Ratio not available, make sure they're scheduled")
-                return
+        # process inputs (built by memoised_build, if not owned they 
+        # must have been scheduled for processing)
+        if not self.rd_num.is_valid() or not self.rd_den.is_valid(): 
+            log().error("Inputs for Ratio not available, make sure they're scheduled")
+            return
 
         # construct root drawable
         g_num = self.rd_num.rootobj()
@@ -882,20 +959,20 @@ class Fit(RootDrawable):
         # members
         if owner: 
             self.add_subrd(rd)
+
+    #____________________________________________________________
+    def get_inputs(self):
+        """Return fitted object (also if not owned)"""
+        return [self.rd]
  
     #____________________________________________________________
     def build_rootobj(self):
         """Build the resolution profile"""        
-        # process inputs
-        if self.owner: 
-            # if owner, need to explicitly build the root objects
-            self.rd.build_rootobj()
-        else:
-            # otherwise they should have been built prior
-            # TODO: can break if order wrong, implement job sequence awareness?
-            if not self.rd.is_valid(): 
-                log().error("Inputs for Fit not available, make sure they're scheduled")
-                return
+        # process inputs (built by memoised_build, if not owned it 
+        # must have been scheduled for processing)
+        if not self.rd.is_valid(): 
+            log().error("Inputs for Fit not available, make sure they're scheduled")
+            return
         h = self.rd.rootobj()
                 
         # create fit function
@@ -18,6 +18,7 @@ import ctypes
 import itertools
 import math
 from array import array
+import numpy as np
 import ROOT
 from loki.core.logger import log
 
@@ -788,11 +789,6 @@ def get_profile(h2,ycalc,name="g_profile",**kwargs):
     :type kwargs: key-word arguments 
     :rtype: :class:`ROOT.TGraph` (or :class:`ROOT.TGraphErrors`)
     """
-    # arrays to store graph points
-    x_arr = array('d', [])
-    y_arr = array('d', [])
-    ey_arr = array('d', [])
-
     # look up ycalc function
     ycalc_name = f"get_{ycalc}"
     if ycalc_name not in globals(): 
@@ -800,35 +796,120 @@ def get_profile(h2,ycalc,name="g_profile",**kwargs):
         return None
     f = globals()[ycalc_name]
 
-    # loop over x-bins
-    for ix in range(1, h2.GetNbinsX() + 1):
-        # get projection in y (in current x-bin) 
-        h_temp = h2.ProjectionY(f"{name}_slice{ix}", ix, ix)
-
-        # get x-value
-        x = h2.GetXaxis().GetBinCenter(ix)
-        x_arr.append(x)
+    # x-values
+    x_arr = bin_centers(h2.GetXaxis())
+    ey_arr = None
 
-        # get y-value (and error if provided)
-        ydata = f(h_temp,**kwargs)
-        if not isinstance(ydata,list): ydata = [ydata]
-        if len(ydata)>0: y_arr.append(ydata[0])
-        if len(ydata)>1: ey_arr.append(ydata[0])
+    # vectorised calculation on all x-bins at once (from bin contents) 
+    if ycalc in _profile_ycalcs: 
+        c = np.array(bin_contents(h2)[1:-1,1:-1], dtype=np.float64)
+        y_arr = _profile_ycalcs[ycalc](c, bin_edges(h2.GetYaxis()), **kwargs)
+    # otherwise loop over x-bins
+    else: 
+        y_arr = []
+        ey_arr = []
+        for ix in range(1, h2.GetNbinsX() + 1):
+            # get projection in y (in current x-bin) 
+            h_temp = h2.ProjectionY(f"{name}_slice{ix}", ix, ix)
+
+            # get y-value (and error if provided)
+            ydata = f(h_temp,**kwargs)
+            if not isinstance(ydata,list): ydata = [ydata]
+            if len(ydata)>0: y_arr.append(ydata[0])
+            if len(ydata)>1: ey_arr.append(ydata[0])
         
-        # remove temp profile hist
-        h_temp.Delete()
+            # remove temp profile hist
+            h_temp.Delete()
+        y_arr = np.array(y_arr, dtype=np.float64)
+        ey_arr = np.array(ey_arr, dtype=np.float64) if ey_arr else None
 
     # create graph with no errors
-    if not ey_arr: 
+    if ey_arr is None: 
         g = ROOT.TGraph(len(x_arr), x_arr, y_arr)
     # create graph with errors
-    elif ey_arr:
-        ex_arr = array('d',[0.] * len(x_arr))
+    else:
+        ex_arr = np.zeros(len(x_arr))
         g = ROOT.TGraphErrors(len(x_arr), x_arr, y_arr, ex_arr, ey_arr)
     g.SetName(name)
     return g
 
 
+#______________________________________________________________________________=buf=
+def __profile_quantiles__(c, edges, probs):
+    """Returns quantiles *probs* of each row of bin contents *c* (vectorised)
+
+    Follows :func:`ROOT.TH1.GetQuantiles`: linear interpolation in the 
+    bin where the normalised cumulative sum crosses the probability. 
+    Rows with zero integral return 0. 
+
+    :param c: in-range bin contents (nx, ny)
+    :type c: :class:`numpy.ndarray`
+    :param edges: y-axis bin edges (ny+1)
+    :type edges: :class:`numpy.ndarray`
+    :param probs: probabilities
+    :type probs: list float
+    :rtype: list :class:`numpy.ndarray`
+    """
+    (nx, ny) = c.shape
+    tot = c.sum(axis=1)
+    valid = tot != 0.
+    cum = np.zeros((nx, ny + 1))
+    cum[:,1:] = np.cumsum(c, axis=1)
+    cum[valid] /= tot[valid,np.newaxis]
+    widths = np.diff(edges)
+    rows = np.arange(nx)
+    quantiles = []
+    for p in probs: 
+        ibin = np.clip((cum[:,:ny] <= p).sum(axis=1) - 1, 0, ny - 1)
+        lo = cum[rows,ibin]
+        dint = cum[rows,ibin+1] - lo
+        frac = np.divide(p - lo, dint, out=np.zeros(nx), where=dint > 0.)
+        q = edges[ibin] + widths[ibin] * frac
+        quantiles.append(np.where(valid, q, 0.))
+    return quantiles
+
+
+#______________________________________________________________________________=buf=
+def __profile_median__(c, edges):
+    """Vectorised :func:`get_median` on each row of bin contents *c*"""
+    return __profile_quantiles__(c, edges, [0.5])[0]
+
+
+#______________________________________________________________________________=buf=
+def __profile_mode__(c, edges):
+    """Vectorised :func:`get_mode` on each row of bin contents *c*"""
+    centers = 0.5 * (edges[1:] + edges[:-1])
+    return centers[np.argmax(c, axis=1)]
+
+
+#______________________________________________________________________________=buf=
+def __profile_rms__(c, edges):
+    """Vectorised :func:`get_rms` on each row of bin contents *c*"""
+    centers = 0.5 * (edges[1:] + edges[:-1])
+    sumw = c.sum(axis=1)
+    sumw = np.where(sumw != 0., sumw, 1.)
+    mean = (c * centers).sum(axis=1) / sumw
+    rms2 = (c * centers**2).sum(axis=1) / sumw - mean**2
+    return np.sqrt(np.clip(rms2, 0., None))
+
+
+#______________________________________________________________________________=buf=
+def __profile_quantile_width__(c, edges, cl=0.68):
+    """Vectorised :func:`get_quantile_width` on each row of bin contents *c*"""
+    q1 = (1. - cl) / 2.
+    (y1, y2) = __profile_quantiles__(c, edges, [q1, 1. - q1])
+    return (y2 - y1) / 2.0
+
+
+# vectorised ycalc functions for :func:`get_profile`
+_profile_ycalcs = {
+    "median": __profile_median__, 
+    "mode": __profile_mode__, 
+    "rms": __profile_rms__, 
+    "quantile_width": __profile_quantile_width__, 
+    }
+
+
 #______________________________________________________________________________=buf=
 def get_inbuilt_rms_profile(h,name="g_scan"):
     """Returns y-axis profile using the "s" option of TH2::ProfileX() 
@@ -871,27 +952,25 @@ def create_roc_graph(h_sig,h_bkg,effmin=None,name="g_roc",normalize=True,reverse
     if (nsig_tot <=0) or (nbkg_tot <= 0):  
         return None
 
-    # loop over hist, calculating efficiency/rejection
-    xarr = array('d',[])
-    yarr = array('d',[])
-    nbins = h_sig.GetNbinsX()
-    for ibin in range(0,nbins+2): 
-        if reverse: 
-            nsig = h_sig.Integral(0, ibin)
-            nbkg = h_bkg.Integral(0, ibin)
-        else:     
-            nsig = h_sig.Integral(ibin,nbins+2)
-            nbkg = h_bkg.Integral(ibin,nbins+2)
-
-        esig = nsig 
-        if normalize: esig /= nsig_tot
-        rbkg = nbkg_tot / nbkg if nbkg else 1.e7
-        
-        if effmin is not None and esig < effmin: continue
-        
-        xarr.append(esig)
-        yarr.append(rbkg)
+    # cumulative sums over hist (including underflow/overflow), 
+    # calculating efficiency/rejection for a cut at each bin
+    csig = bin_contents(h_sig).astype(np.float64)
+    cbkg = bin_contents(h_bkg).astype(np.float64)
+    if reverse: 
+        nsig = np.cumsum(csig)
+        nbkg = np.cumsum(cbkg)
+    else: 
+        nsig = np.cumsum(csig[::-1])[::-1]
+        nbkg = np.cumsum(cbkg[::-1])[::-1]
+
+    esig = nsig / nsig_tot if normalize else nsig
+    rbkg = np.divide(nbkg_tot, nbkg, out=np.full(len(nbkg), 1.e7), where=nbkg != 0.)
+    if effmin is not None: 
+        keep = esig >= effmin
+        (esig, rbkg) = (esig[keep], rbkg[keep])
 
+    xarr = np.ascontiguousarray(esig)
+    yarr = np.ascontiguousarray(rbkg)
     g = ROOT.TGraph(len(xarr),xarr,yarr)
     g.SetName(name)
     return g
@@ -1038,7 +1117,115 @@ def set_axis_binnames(axis, binnames):
         axis.SetBinLabel(i+1,binnames[i])
 
 
+#______________________________________________________________________________=buf=
+def bin_contents(h):
+    """Returns zero-copy numpy view of the bin contents of histogram *h*
+
+    The view includes the underflow/overflow bins and is indexed like 
+    the ROOT bins, ie. ``c[ix]``, ``c[ix,iy]`` or ``c[ix,iy,iz]`` for 
+    1D, 2D or 3D hists (with ``c[1:-1]`` the in-range bins). The dtype 
+    follows the histogram type (eg. float32 for TH1F). Writing to the 
+    view modifies the histogram, note the stats (mean, rms, entries) 
+    are not updated (use *h.ResetStats()* if needed).
+
+    :param h: histogram
+    :type h: :class:`ROOT.TH1`
+    :rtype: :class:`numpy.ndarray`
+    """
+    return __as_bin_array__(h, h.GetArray(), __get_dtype__(h))
 
 
+#______________________________________________________________________________=buf=
+def bin_sumw2(h, create=False):
+    """Returns zero-copy numpy view of the sum of weights squared of histogram *h*
+
+    Indexed as :func:`bin_contents`. If the histogram doesn't store 
+    the sum of weights squared, None is returned, unless *create*, 
+    in which case the structure is created (initialised from the 
+    current bin contents, so do this before modifying the contents).
+
+    :param h: histogram
+    :type h: :class:`ROOT.TH1`
+    :param create: create sumw2 structure if not available
+    :type create: bool
+    :rtype: :class:`numpy.ndarray`
+    """
+    if not h.GetSumw2N(): 
+        if not create: return None
+        h.Sumw2()
+    return __as_bin_array__(h, h.GetSumw2().GetArray(), np.float64)
+
+
+#______________________________________________________________________________=buf=
+def bin_errors(h):
+    """Returns numpy array of the bin errors of histogram *h*
+
+    Indexed as :func:`bin_contents`. Unlike the contents this is not 
+    a view (errors are stored as sum of weights squared). 
+
+    :param h: histogram
+    :type h: :class:`ROOT.TH1`
+    :rtype: :class:`numpy.ndarray`
+    """
+    sumw2 = bin_sumw2(h)
+    if sumw2 is None: return np.sqrt(np.abs(bin_contents(h), dtype=np.float64))
+    return np.sqrt(sumw2)
+
+
+#______________________________________________________________________________=buf=
+def bin_edges(axis):
+    """Returns numpy array of bin edges of *axis* (excluding underflow/overflow)
+
+    :param axis: axis
+    :type axis: :class:`ROOT.TAxis`
+    :rtype: :class:`numpy.ndarray`
+    """
+    xbins = axis.GetXbins()
+    if xbins.GetSize(): 
+        return np.array(__as_array__(xbins.GetArray(), xbins.GetSize(), np.float64))
+    return np.linspace(axis.GetXmin(), axis.GetXmax(), axis.GetNbins() + 1)
+
+
+#______________________________________________________________________________=buf=
+def bin_centers(axis):
+    """Returns numpy array of bin centers of *axis* (excluding underflow/overflow)
+
+    :param axis: axis
+    :type axis: :class:`ROOT.TAxis`
+    :rtype: :class:`numpy.ndarray`
+    """
+    edges = bin_edges(axis)
+    return 0.5 * (edges[1:] + edges[:-1])
+
+
+#______________________________________________________________________________=buf=
+def __get_dtype__(h):
+    """Returns numpy dtype of the bin content array of histogram *h*"""
+    for (cls, dtype) in [(ROOT.TArrayD, np.float64), (ROOT.TArrayF, np.float32), 
+                         (ROOT.TArrayI, np.int32), (ROOT.TArrayS, np.int16), 
+                         (ROOT.TArrayC, np.int8)]: 
+        if isinstance(h, cls): return dtype
+    log().error(f"Unsupported histogram type: {h.ClassName()}")
+    raise TypeError
+
+
+#______________________________________________________________________________=buf=
+def __as_array__(buf, n, dtype):
+    """Returns 1D numpy view of length *n* on ROOT array buffer *buf*"""
+    # cppyy (ROOT >= 6.22) low-level views vs legacy PyROOT buffers
+    if hasattr(buf, "reshape"): buf = buf.reshape((n,))
+    elif hasattr(buf, "SetSize"): buf.SetSize(n)
+    return np.frombuffer(buf, dtype=dtype, count=n)
+
+
+#______________________________________________________________________________=buf=
+def __as_bin_array__(h, buf, dtype):
+    """Returns numpy view on per-bin array *buf* of *h*, indexed by (ix, iy, iz)"""
+    shape = [h.GetNbinsX() + 2]
+    if h.GetDimension() > 1: shape.append(h.GetNbinsY() + 2)
+    if h.GetDimension() > 2: shape.append(h.GetNbinsZ() + 2)
+    # ROOT global bins run fastest in x, so reverse the shape and transpose
+    return __as_array__(buf, h.GetNcells(), dtype).reshape(shape[::-1]).T
+
 
 ## EOF
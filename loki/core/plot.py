@@ -13,6 +13,9 @@ The derived classes provide an easy interface to generate the input ROOT
 drawable objects, such as histograms, efficiency graphs, resolution graphs,
 etc.
 
+Large plot books can be drawn and saved in parallel batch-mode worker 
+processes via :func:`render_plots`.
+
 """
 __author__    = "Will Davey"
 __email__     = "will.davey@cern.ch"
@@ -21,7 +24,11 @@ __copyright__ = "Copyright 2016 Will Davey"
 __license__   = "GPL http://www.gnu.org/licenses/gpl.html"
 
 ## modules
+import atexit
 import os
+import shutil
+import tempfile
+from multiprocessing import Pool, cpu_count
 import ROOT
 import loki
 import loki.core.histutils as histutils
@@ -135,6 +142,8 @@ class Plot():
         self.xvar = self.rd0.xvar
         self.yvar = self.rd0.yvar
         self.canvas = None
+        self.rendered = False
+        self.fcanvas = None
         self.leg = None
         self.ratio_rds = []
         
@@ -143,8 +152,12 @@ class Plot():
             self.__create_ratios__()
 
     #____________________________________________________________
-    def draw(self):
-        """Draw and save the plot"""
+    def draw(self, save=True):
+        """Draw and save the plot
+        
+        :param save: save the canvas to file for each of *fexts*
+        :type save: bool
+        """
         if self.no_rds_valid():
             log().warn(f"{self.name} has no valid drawable objects, skipping plot draw.")
             return
@@ -157,9 +170,9 @@ class Plot():
 
         # draw canvas
         if self.doratio: 
-            self.__draw_ratio__()
+            self.__draw_ratio__(save)
         else: 
-            self.__draw_standard__()
+            self.__draw_standard__(save)
 
     #____________________________________________________________
     def write(self,fout):
@@ -184,10 +197,19 @@ class Plot():
                 fout.mkdir(path)
             fout = fout.GetDirectory(path)
         
-        if not self.canvas: 
+        # plots rendered by worker processes are copied from the canvas 
+        # file written by the worker (or redrawn without saving if missing)
+        canvas = self.canvas
+        if not canvas and self.rendered: 
+            canvas = self.__read_rendered_canvas__()
+            if not canvas: 
+                self.draw(save=False)
+                canvas = self.canvas
+        if not canvas: 
             log().warn(f"{self.name} has no canvas, can't write")
         else:         
-            fout.WriteTObject(self.canvas)
+            fout.WriteTObject(canvas)
+            if canvas is not self.canvas: canvas.Close()
         # write sub-objects to hist dir
         hdir = fout.GetDirectory("hists")
         if not hdir: hdir = fout.mkdir("hists")
@@ -196,6 +218,18 @@ class Plot():
             rd.write(hdir)
         
 
+    #____________________________________________________________
+    def __read_rendered_canvas__(self):
+        """Return canvas written by the render worker (None if not available, see :func:`render_plots`)"""
+        if not self.fcanvas: return None
+        (fname, cname) = self.fcanvas
+        if not os.path.exists(fname): return None
+        f = ROOT.TFile.Open(fname)
+        if not f: return None
+        c = f.Get(cname)
+        f.Close()
+        return c or None
+
     #____________________________________________________________
     def get_component_hists(self):
         """Returns a list of hists from the drawables
@@ -224,7 +258,7 @@ class Plot():
         return (True not in [r.is_valid() for r in self.rds+self.stack_rds+self.ratio_rds])
 
     #____________________________________________________________
-    def __draw_standard__(self):
+    def __draw_standard__(self, save=True):
         """Underlying draw function for standard single pad plot"""
         log().debug("in Plot.__draw_standard__")
         
@@ -266,14 +300,14 @@ class Plot():
         self.__fill_upper_pad__(p1)        
         
         # save canvas
-        self.__save_canvas__(c)
+        if save: self.__save_canvas__(c)
         self.canvas = c
         self.pad1 = p1
         
         log().debug("finished __draw_standard__")
 
     #____________________________________________________________
-    def __draw_ratio__(self):
+    def __draw_ratio__(self, save=True):
         """Underlying draw function for ratio plot"""
         if self.no_rds_valid():
             log().warn(f"{self.name} has no valid drawable objects, skipping plot draw.")
@@ -337,7 +371,7 @@ class Plot():
         self.__fill_lower_pad__(p2)
 
         # finalize
-        self.__save_canvas__(c)
+        if save: self.__save_canvas__(c)
         self.canvas = c
         self.pad1 = p1
         self.pad2 = p2
@@ -654,4 +688,78 @@ class Plot():
             log().info(f"Written {fname}")
 
 
+# - - - - - - - - - - - - - - - function defs - - - - - - - - - - - - - - - - #
+#: plots to be drawn by the render workers (inherited on fork, see :func:`render_plots`)
+_render_plots = None
+#: dir for the canvas files written by the render workers
+_render_dir = None
+
+#______________________________________________________________________________=buf=
+def render_plots(plots, ncores=None):
+    """Draw and save *plots* in a pool of batch-mode worker processes
+    
+    The ROOT objects of the plots must already be built (eg. by the 
+    :class:`~loki.core.process.Processor`). The workers are forked from 
+    the current process, so they inherit the built objects without any 
+    serialization. Each worker draws and saves a share of the plots 
+    (output file names only depend on the plot names, so they are the 
+    same as for serial drawing). 
+    
+    The canvases only exist in the workers. Each worker also writes the 
+    canvas of each plot to a ROOT file in a temporary dir (removed at 
+    exit), from which :func:`Plot.write` copies it, so that the plots 
+    aren't drawn again in the driver. Rendered plots without a canvas 
+    file are redrawn (without saving) if written. 
+    
+    :param plots: plots
+    :type plots: list :class:`Plot`
+    :param ncores: number of worker processes (default: all, negative: all but |n|)
+    :type ncores: int
+    """
+    global _render_plots, _render_dir
+    if   not ncores:  ncores = cpu_count()
+    elif ncores < 0:  ncores = max(1, cpu_count() + ncores)
+    ncores = min(ncores, len(plots))
+    if ncores <= 1: 
+        for p in plots: p.draw()
+        return
+    
+    log().info(f"Rendering {len(plots)} plots on {ncores} cores")
+    _render_plots = plots
+    if not _render_dir: 
+        _render_dir = tempfile.mkdtemp(prefix='loki_render_')
+        atexit.register(shutil.rmtree, _render_dir, ignore_errors=True)
+    pool = Pool(processes=ncores)
+    chunksize = max(1, len(plots) // (4 * ncores))
+    status = list(pool.imap(render_plot, range(len(plots)), chunksize))
+    pool.close()
+    pool.join()
+    _render_plots = None
+    for (p, (ok, fcanvas)) in zip(plots, status): 
+        p.rendered = ok
+        p.fcanvas = fcanvas
+
+
+#______________________________________________________________________________=buf=
+def render_plot(i):
+    """Draw and save plot *i* of the current render job (executed on worker)
+    
+    Returns (drawn, (canvas file, canvas name)), where the canvas file 
+    is None if it couldn't be written. 
+    """
+    ROOT.gROOT.SetBatch(True)
+    p = _render_plots[i]
+    p.draw()
+    if not p.canvas: return (False, None)
+    # write canvas for the driver, then free it (not returned to driver)
+    fname = os.path.join(_render_dir, f"canvas_{os.getpid()}_{i}.root")
+    cname = p.canvas.GetName()
+    f = ROOT.TFile.Open(fname, "RECREATE")
+    ok = bool(f) and f.WriteTObject(p.canvas) > 0
+    if f: f.Close()
+    p.canvas.Close()
+    p.canvas = None
+    return (True, (fname, cname) if ok else None)
+
+
 ## EOF
@@ -29,28 +29,55 @@ __license__   = "GPL http://www.gnu.org/licenses/gpl.html"
 ## modules
 import hashlib
 import itertools
+import json
 import logging
 import shutil
 import tempfile
 import time
 import operator
 import os
+import ctypes
 from array import array
-from multiprocessing import Pool, cpu_count 
+from collections import OrderedDict
+from contextlib import nullcontext
+from multiprocessing import Lock, Pool, cpu_count 
+from multiprocessing.sharedctypes import RawArray
 
 import ROOT
 
 from loki.core import filelock
 from loki.core.filelock import FileLock #, TimeoutError TODO: INVESTIGATE: What does timeout error do????? How diud this work in Py2?
 from loki.core.helpers import ProgressBar, mkdir_p
-from loki.core.histutils import new_hist
+from loki.core.hist import EffProfile, Hist
+from loki.core.histutils import bin_contents, bin_errors, new_hist
 from loki.core.logger import log
-from loki.core.plot import Plot
+from loki.core.plot import Plot, render_plots
+from loki.core.telemetry import Telemetry, job_stats, now
 from loki.core.var import VarError, default_cut, default_weight
 from loki.utils.system import get_project_path
 
 filelock.logger.setLevel(logging.WARNING)
 
+#: progress monitor and slot of the current worker process (see :func:`init_worker`)
+_worker_monitor = None
+_worker_slot = None
+#: input files kept open by the current worker process (see :func:`keep_input_files`)
+_worker_files = None
+_worker_max_files = 0
+#: True once the cpp classes are loaded in the current process
+_cpp_classes_loaded = False
+#: job spec format version (see :func:`write_job_spec` and src/LokiJob.h)
+JOB_SPEC_VERSION = 1
+#: ints per hist in the packed booking table (see :func:`pack_booking`)
+BOOK_FIELDS = 15
+#: output compression profiles (ROOT compression settings: 100 * algorithm + level, 
+#: None: ROOT default), see :func:`get_compression_settings`
+COMPRESSION_PROFILES = OrderedDict([
+    ("default", None),
+    ("fast", 404),   # LZ4 level 4: fast read
+    ("small", 509),  # ZSTD level 9: small size
+    ])
+
 
 # - - - - - - - - - - - class defs  - - - - - - - - - - - - #
                 
@@ -84,26 +111,173 @@ class Processor():
     :type noweight: bool
     :param usecache: use histogram caching
     :type usecache: bool
+    :param telemetry: write run telemetry (Chrome trace JSON) to this file
+    :type telemetry: str
+    :param pipeline: overlap reading/decompression with filling (bulk-read path only)
+    :type pipeline: bool
+    :param precision: target relative uncertainty per bin of component hists (enables adaptive mode)
+    :type precision: float
+    :param precision_eff: target absolute uncertainty per point of efficiency profiles (enables adaptive mode)
+    :type precision_eff: float
+    :param preview: event fraction for preview pass in :func:`draw_plots` (enables progressive mode)
+    :type preview: float
+    :param nshards: split each input file into up to this many entry-range jobs
+    :type nshards: int
+    :param render: number of worker processes to draw and save plots (default: draw serially)
+    :type render: int
+    :param daemon: process selectors on the warm :class:`~loki.core.daemon.ProcessingDaemon` at this socket path (True: default path)
+    :type daemon: str or bool
+    :param lazy: defer processing until results are accessed (see :func:`run`)
+    :type lazy: bool
+    :param executor: run selectors as standalone jobs on this backend ("local", "pbs", "condor")
+    :type executor: :class:`~loki.core.executor.Executor` or str
+    :param colcache: cache decoded input columns in ``~/.lokicache/columns``
+    :type colcache: bool
         
+    While processing, each worker publishes its live event count and bytes 
+    read (see :class:`ProgressMonitor`), which are used to report the 
+    throughput, the read rate (MB/s, eg. to spot slow storage) and the 
+    ETA. A warning is issued if a worker makes no progress 
+    for *stall_time* seconds.
+
+    Adaptive mode: if a *precision* target is given, *event_frac* is 
+    ignored. Instead the events are processed in passes of increasing 
+    event fraction (*precision_fracs*), each pass taking the same fraction 
+    of every input file. Processing stops once every component hist 
+    meets the target relative uncertainty in all bins above 
+    *precision_min_frac* of its maximum (under/overflow bins are not 
+    checked), and every efficiency profile meets *precision_eff*. Each 
+    pass is cached like a regular event-fraction pass. The fraction that 
+    was sufficient is recorded in ``~/.lokicache/precision.json``, so later 
+    runs of the same job start from there. If the target isn't met with 
+    all events, nothing is recorded. The fraction used is available as 
+    *effective_event_frac*.
+
+    Progressive mode: if a *preview* event fraction is given (eg. 0.01), 
+    :func:`draw_plots` first processes and draws the plots from the preview 
+    fraction. It then processes the full statistics. Every *preview_interval* 
+    seconds the plots are redrawn from a partial merge: files that have 
+    finished use the full result, and the other files use the scaled-up 
+    preview result. The final plots are drawn from the full statistics as 
+    usual.
+
+    Sharding: by default there is one selector job per input file, so 
+    samples with fewer files than cores (eg. single-file training 
+    samples) can't use the full pool. If *nshards* is given, each input 
+    file is split into up to *nshards* jobs over consecutive entry ranges. 
+    The shard outputs are merged like separate files, and are summed 
+    into the cache once all shards of a file have finished. 
+
+    Daemon: if *daemon* is given, the selectors are sent to a running 
+    :class:`~loki.core.daemon.ProcessingDaemon` (see ``loki daemon start``), 
+    which keeps its workers, the compiled cpp classes and the open input 
+    files warm across calls. *ncores* is then set by the daemon. If the 
+    daemon can't be reached, a local worker pool is used. 
+
+    Executor: if *executor* is given, the selectors are instead run by 
+    the standalone executor (``lokirun``, see scripts/build_lokirun.sh), 
+    either as a job array on a PBS/HTCondor batch system 
+    (:class:`~loki.core.executor.BatchExecutor`) or as local subprocesses 
+    (:class:`~loki.core.executor.LocalExecutor`). The selectors are grouped 
+    into jobs of similar estimated cost, and their outputs are written to 
+    the executor's work dir on the shared filesystem, from where they are 
+    cached and merged as usual. 
+
+    Column cache: if *colcache*, the selectors keep the decoded values of 
+    the input branches they read in memory-mapped files (in the branch's 
+    native type) under ``~/.lokicache/columns``, keyed by the input file 
+    hash (path and modification time) and tree name. Later runs over the 
+    same files then read those columns from the page cache instead of 
+    decompressing the baskets, eg. when only the plot definitions change 
+    in an interactive session. Flat scalar branches are cached by the 
+    bulk-read fast path. Jagged branches (eg. TauJets variables) can't be 
+    bulk read: they are cached as values plus per-entry offsets, filled on 
+    the TTreeFormula path, so only later runs read them via the fast path. 
+    The cache is filled by runs starting at the first entry of a file (ie. 
+    not by later shards), and is extended when a later run covers more 
+    entries. Stale caches (input file modified or removed, or unused for 
+    30 days) are removed at the start of each run (see :func:`prune_colcache`).
+
+    Lazy mode: if *lazy*, :func:`process` and :func:`draw_plots` only 
+    record the bookings. Everything booked so far is processed together 
+    in a single pass over each input file when :func:`run` is called, 
+    when the Processor is used as a context manager and the block exits, 
+    or when the result of a booked drawable is first accessed (eg. via 
+    ``rootobj()``, ``is_valid()`` or drawing a plot). Scripts that call 
+    :func:`process` or :func:`draw_plots` several times on the same 
+    samples then read each file once. Plots booked with :func:`draw_plots` 
+    are drawn after the pass. 
+
+    Flat ntuples: :func:`register_ntup` books a flat ntuple (as written 
+    by :func:`~loki.train.ntup.flatten_ntup`), which is written by the 
+    same selectors that fill the hists, so that training ntuples and 
+    their control plots are produced in a single pass over the inputs. 
     """
+    #: time [s] without progress after which a worker is considered stalled
+    stall_time = 60.
+    #: event fraction ladder used in adaptive (precision) mode
+    precision_fracs = [0.01, 0.03, 0.1, 0.3, 1.0]
+    #: bins below this fraction of the hist maximum are ignored in precision checks
+    precision_min_frac = 0.01
+    #: minimum time [s] between plot updates in progressive (preview) mode
+    preview_interval = 30.
     #__________________________________________________________________________=buf=
     def __init__(self,
                  event_frac=None,
                  ncores=None,
                  noweight=False,
                  usecache=True,
+                 telemetry=None,
+                 pipeline=False,
+                 precision=None,
+                 precision_eff=None,
+                 preview=None,
+                 nshards=None,
+                 render=None,
+                 daemon=None,
+                 lazy=False,
+                 executor=None,
+                 colcache=False,
                  ):        
         # config
         self.event_frac = self.__discritize_event_frac__(event_frac)
         self.ncores = ncores
         self.noweight = noweight
         self.usecache = usecache
+        self.ftelemetry = telemetry
+        self.pipeline = pipeline
+        self.precision = precision
+        self.precision_eff = precision_eff
+        self.preview = preview
+        self.nshards = nshards
+        self.render = render
+        self.daemon = daemon
+        self.lazy = lazy
+        if isinstance(executor, str): 
+            from loki.core.executor import get_executor
+            executor = get_executor(executor, ncores=ncores)
+        self.executor = executor
+        self.colcache = colcache
 
         # members
         self.hists = []
         self.drawables = []
+        self.ntups = []
         self.processed_drawables = []
         self.jobs = {}
+        self.telemetry = None
+        self.effective_event_frac = None
+        self.completed = set()
+        self.render_pending = False
+
+    #__________________________________________________________________________=buf=
+    def __enter__(self):
+        return self
+
+    #__________________________________________________________________________=buf=
+    def __exit__(self, exc_type, exc_value, traceback):
+        if exc_type is None: self.run()
+        return False
 
     #__________________________________________________________________________=buf=
     def register(self,drawables):
@@ -117,6 +291,46 @@ class Processor():
         self.drawables += drawables
         #self.hists+=drawable.get_component_hists()
 
+    #__________________________________________________________________________=buf=
+    def register_ntup(self, sample, invars, sel=None, fout=None, useweight=False, 
+                      compression=None):
+        """Register flat ntuple to be written in the next processing pass
+        
+        The arguments and output are the same as for 
+        :func:`~loki.train.ntup.flatten_ntup`, but the ntuple is written 
+        by the LokiSelector (see LokiNtup) in the same event loop that 
+        fills the hists of the registered drawables, sharing the formula 
+        evaluation. The configured event fraction (or shard) also applies 
+        to the ntuple. Ntuples are not cached. The storage precision of 
+        the variables (see :class:`~loki.core.var.VarBase`) is respected. 
+        Ntuples are only written at the configured event fraction, never 
+        in the preview pass of the progressive mode. In the adaptive mode 
+        (*precision*), they are written in the pass at the configured 
+        fraction (ie. all events unless *event_frac* is set). If the 
+        passes stop below that fraction, the ntuples cost an additional 
+        pass over the inputs (without the hists). 
+
+        :param sample: input sample
+        :type sample: :class:`~loki.core.sample.Sample`
+        :param invars: variables to write out
+        :type invars: list :class:`~loki.core.var.VarBase`
+        :param sel: selection
+        :type sel: :class:`~loki.core.var.VarBase`
+        :param fout: name of output ntuple
+        :type fout: str
+        :param useweight: use sample weight and xsec scale
+        :type useweight: bool
+        :param compression: output compression profile (see :func:`get_compression_settings`)
+        :type compression: str or int
+        """
+        mvconts = set([c for v in invars for c in v.get_mvinconts()])
+        if len(mvconts) >= 2: 
+            log().error("Found multiple multi-valued containers in register_ntup()")
+            raise ValueError
+        self.ntups.append({"sample": sample, "invars": list(invars), "sel": sel, 
+                           "fout": fout, "useweight": useweight, 
+                           "compress": get_compression_settings(compression), "parts": []})
+
     #__________________________________________________________________________=buf=
     def process(self,drawables=None):
         """Construct all registered objects
@@ -128,7 +342,33 @@ class Processor():
         """
         if drawables is not None: 
             self.register(drawables)
+        if self.lazy: 
+            self.__defer__()
+            return
         self.__process__()
+
+    #__________________________________________________________________________=buf=
+    def run(self):
+        """Execute all deferred bookings (lazy mode)
+        
+        All drawables booked via :func:`process` and :func:`draw_plots` 
+        since the last run are processed in a single pass, then the 
+        plots booked with :func:`draw_plots` are drawn. Called 
+        automatically when a booked result is first accessed. 
+        """
+        for rd in self.drawables: 
+            set_pending(rd, None)
+        if self.drawables or self.ntups: 
+            self.__process__(progressive=self.render_pending and self.preview is not None)
+        if self.render_pending: 
+            self.render_pending = False
+            self.__render__(self.processed_drawables)
+
+    #__________________________________________________________________________=buf=
+    def __defer__(self):
+        """Mark registered drawables as pending on this processor (lazy mode)"""
+        for rd in self.drawables: 
+            set_pending(rd, self)
         
     #__________________________________________________________________________=buf=
     def draw_plots(self,plots=None):
@@ -141,10 +381,12 @@ class Processor():
         """
         if plots is not None: 
             self.register(plots)
-        self.__process__()
-        for p in self.processed_drawables:
-            if not isinstance(p, Plot): continue
-            p.draw()
+        if self.lazy: 
+            self.render_pending = True
+            self.__defer__()
+            return
+        self.__process__(progressive=self.preview is not None)
+        self.__render__(self.processed_drawables)
         
 
     #__________________________________________________________________________=buf=
@@ -154,11 +396,12 @@ class Processor():
         :param f: output file
         :type f: :class:`ROOT.TFile`
         """
+        if self.lazy: self.run()
         for rd in self.processed_drawables:
             rd.write(f)
            
     #__________________________________________________________________________=buf=
-    def __process__(self):
+    def __process__(self, progressive=False):
         """Process all registered drawable objects
         
         Workflow: 
@@ -170,21 +413,213 @@ class Processor():
         * Process selectors using pool of threads, sequentially writing processed hists to cache. 
         * Merge hists for each subsample and scale. 
         * Construct higher level objects in the RootDrawables from component hists
-              
+        
+        If *telemetry* is configured, the timing of each phase and each
+        selector job is recorded and written out at the end (see 
+        :mod:`loki.core.telemetry`).
+        
+        If *progressive*, plots are drawn from a preview pass first and 
+        updated while the full statistics are processed. 
         """
         log().info("Hist processor in da haus!")
-        if not self.drawables: 
+        if not self.drawables and not self.ntups: 
             log().info("Nothing to process")
             return
+        if self.ftelemetry: self.telemetry = Telemetry()
+
+        if self.precision or self.precision_eff: 
+            self.__process_adaptive__()
+        elif progressive: 
+            self.__process_progressive__()
+        else: 
+            self.__process_pass__()
+            
+        # accounting
+        self.processed_drawables += self.drawables
+        self.drawables = []
+        self.ntups = []
+
+        if self.telemetry: 
+            self.telemetry.write(self.ftelemetry)
+            self.telemetry = None
 
+    #__________________________________________________________________________=buf=
+    def __process_pass__(self, ntups=True):
+        """Process registered drawables (and ntuples if *ntups*) at the configured event fraction"""
         # organise RootDrawable component hists into selector jobs 
-        selectors = self.__get_selectors__()
+        with self.__phase__("catalogue"):
+            selectors = self.__get_selectors__(ntups=ntups)
         
         # process selector jobs using pool of worker threads
         self.__process_selectors__(selectors)
 
         ## construct drawables from component hists and clean up
-        self.__finalize_outputs__()
+        with self.__phase__("finalize"):
+            self.__finalize_outputs__(ntups=ntups)
+
+    #__________________________________________________________________________=buf=
+    def __process_adaptive__(self):
+        """Process in passes of increasing event fraction until the precision targets are met
+        
+        The precision targets only apply to the hists: registered ntuples are 
+        written in the pass at the configured event fraction, or in a separate 
+        pass afterwards if the passes stop before reaching it. 
+        """
+        event_frac = self.event_frac
+        fracs = self.precision_fracs
+        ntup_frac = event_frac or 1.
+        ntups_done = not self.ntups
+        
+        # start from the fraction recorded for this job (if any) 
+        with self.__phase__("catalogue"):
+            key = f"{self.__get_job_key__()}:{self.precision}:{self.precision_eff}"
+        record = read_precision_record()
+        if key in record: 
+            fracs = [f for f in fracs if f >= record[key]] or fracs[-1:]
+            log().info(f"Found recorded event fraction for precision target: {record[key]}")
+        
+        met = False
+        for frac in fracs: 
+            self.event_frac = frac if frac < 1. else None
+            ntups = not ntups_done and abs(frac - ntup_frac) < 1.e-9
+            self.__process_pass__(ntups=ntups)
+            ntups_done = ntups_done or ntups
+            met = self.__check_precision__()
+            if met: 
+                break
+            if frac < 1.: 
+                log().info(f"Precision target not met with {frac*100.:.0f}% of events, continuing")
+        self.effective_event_frac = frac
+        if self.telemetry: self.telemetry.set(effective_event_frac=frac)
+        if met: 
+            log().info(f"Precision target met using {frac*100.:.0f}% of events")
+            write_precision_record(key, frac)
+        else: 
+            log().warn(f"Precision target not reached with {frac*100.:.0f}% of events")
+        self.event_frac = event_frac
+
+        # ntuples at the configured event fraction (if not reached)
+        if not ntups_done: 
+            log().info("Writing ntuples (additional pass)")
+            drawables = self.drawables
+            self.drawables = []
+            self.__process_pass__()
+            self.drawables = drawables
+
+    #__________________________________________________________________________=buf=
+    def __get_job_key__(self):
+        """Return key identifying the job (input files and hists), independent of the event fraction
+        
+        Used to look up the precision record (see :func:`__process_adaptive__`) 
+        without preparing any selectors. 
+        """
+        job_hash = hashlib.md5("".encode())
+        files = dict()
+        for rd in self.drawables: 
+            for h in rd.get_component_hists():
+                for s in h.sample.get_final_daughters():
+                    if not s.files: continue
+                    (sel, weight) = self.__get_sel_weight__(h, s)
+                    for f in s.files: 
+                        if f not in files: files[f] = (file_hash(f), s.get_tree(f))
+                        (fhash, tree) = files[f]
+                        for var in [h.xvar, h.yvar, h.zvar]: 
+                            if var: var.var.tree_init(tree)
+                        for var in [sel, weight]: 
+                            if var: var.tree_init(tree)
+                        hhash = hist_hash(xvar=h.xvar, yvar=h.yvar, zvar=h.zvar, 
+                                          sel=sel, wei=weight)
+                        job_hash.update(f"{fhash}:{hhash}|".encode())
+        return job_hash.hexdigest()
+
+    #__________________________________________________________________________=buf=
+    def __get_sel_weight__(self, h, s):
+        """Return (selection, weight) for component hist *h* of sample *s*"""
+        # combine selection from hist and sample
+        sel = default_cut()
+        if h.sel: sel = sel & h.sel
+        if s.sel: sel = sel & s.sel
+
+        # combine weight from hist and sample
+        weight = default_weight()
+        if not self.noweight: 
+            if h.weight: weight = weight * h.weight
+            if s.weight: weight = weight * s.weight
+        return (sel, weight)
+
+    #__________________________________________________________________________=buf=
+    def __process_progressive__(self):
+        """Process and draw a preview pass, then process the full statistics,
+        periodically redrawing the plots from partial merges
+        
+        Registered ntuples are only written in the full-statistics pass. 
+        """
+        event_frac = self.event_frac
+        self.event_frac = self.preview
+        log().info(f"Processing preview with {self.preview*100.:.1f}% of events")
+        self.__process_pass__(ntups=False)
+        for rd in self.drawables: 
+            for h in rd.get_component_hists(): 
+                h.preview_components = h.components
+        self.__draw_plots__()
+        
+        log().info("Preview ready, continuing with full statistics")
+        self.event_frac = event_frac
+        with self.__phase__("catalogue"):
+            selectors = self.__get_selectors__()
+        self.__process_selectors__(selectors, callback=self.__update_preview__)
+        with self.__phase__("finalize"):
+            self.__finalize_outputs__()
+        for rd in self.drawables: 
+            for h in rd.get_component_hists(): 
+                h.preview_components = None
+
+    #__________________________________________________________________________=buf=
+    def __update_preview__(self):
+        """Redraw plots from partial merge of finished and preview components"""
+        log().debug("Updating preview plots")
+        self.__finalize_outputs__(preview=True)
+        self.__draw_plots__()
+
+    #__________________________________________________________________________=buf=
+    def __draw_plots__(self):
+        """Draw registered plots"""
+        self.__render__(self.drawables)
+
+    #__________________________________________________________________________=buf=
+    def __render__(self, drawables):
+        """Draw and save plots in *drawables* (in parallel if *render* set)"""
+        plots = [p for p in drawables if isinstance(p, Plot)]
+        if self.render and len(plots) > 1: 
+            render_plots(plots, ncores=self.render)
+        else: 
+            for p in plots: p.draw()
+
+    #__________________________________________________________________________=buf=
+    def __check_precision__(self):
+        """Return True if all drawables meet the precision targets"""
+        def check(rd):
+            if isinstance(rd, Plot): 
+                return all([check(r) for r in rd.rds + rd.stack_rds])
+            if isinstance(rd, Hist): 
+                return not self.precision or hist_meets_precision(
+                    rd.rootobj(), self.precision, self.precision_min_frac)
+            if isinstance(rd, EffProfile) and self.precision_eff: 
+                if not graph_meets_precision(rd.rootobj(), self.precision_eff): return False
+            return all([check(s) for s in rd._subrds])
+        
+        status = True
+        for rd in self.drawables:
+            if not check(rd): 
+                log().debug(f"{rd.name} doesn't meet precision target")
+                status = False
+        return status
+        
+    #__________________________________________________________________________=buf=
+    def __phase__(self, name):
+        """Return context manager recording phase *name* in the telemetry (if enabled)"""
+        if self.telemetry: return self.telemetry.phase(name)
+        return nullcontext()
 
     #__________________________________________________________________________=buf=
     def __discritize_event_frac__(self, event_frac):
@@ -196,7 +631,7 @@ class Processor():
         return new_event_frac
 
     #__________________________________________________________________________=buf=
-    def __get_selectors__(self):
+    def __get_selectors__(self, ntups=True):
         """Configure RootDrawable components into selectors
         
         Work flow is: 
@@ -205,6 +640,7 @@ class Processor():
           are made for each input file)
         * Look for cached versions of hists
         * Collect uncached hists in selector configs (one selector per input file)
+        * Add the registered ntuples to the selectors (if *ntups*)
         
         The histograms are grouped into selectors based on their input file 
         (a separate selector job is made for each individual input file)
@@ -214,15 +650,59 @@ class Processor():
         """
         event_frac = self.__discritize_event_frac__(self.event_frac)
         log().info("Preparing jobs...")
+        if self.colcache: prune_colcache()
         log().info("Using {:.1f}% of available events".format(event_frac*100. if event_frac else 100.))
         
         # create tmp working path
-        tmpdir = tempfile.mkdtemp(prefix='loki_')
+        # (on the shared filesystem for executor jobs)
+        workdir = self.executor.workdir if self.executor else None
+        if workdir: mkdir_p(workdir)
+        tmpdir = tempfile.mkdtemp(prefix='loki_', dir=workdir)
         log().info(f"Created tmp work dir: {tmpdir}")
         
         # group hists into selector jobs based on mvcont and input file
         selector_dict = dict()
         file_dict = dict()
+        tcache_lookup = 0.
+
+        def get_shards(s, f, mvcont):
+            """Return (hash, tree, selectors (shards)) for file *f* of sample *s* and *mvcont*"""
+            if not mvcont in selector_dict: 
+                selector_dict[mvcont] = dict() 
+            # get and cache input file hash and tree
+            if f not in file_dict:
+                file_dict[f] = {"hash":file_hash(f), "tree":s.get_tree(f)}
+            fhash = file_dict[f]["hash"]
+            tree = file_dict[f]["tree"]
+                
+            # get and cache selectors (shards) for this file and mvcont
+            if f not in selector_dict[mvcont]:
+                # number of events to process for selector
+                n = s.get_nevents(f)
+                if event_frac: n = int(event_frac*float(n))
+                # cache path for this input file  
+                fcache = os.path.join(os.getenv('HOME'), ".lokicache", f"{fhash}.root")
+                colcache = None
+                if self.colcache: 
+                    colcache = get_colcache_path(fhash, s.treename)
+                    touch_colcache(fhash, f)
+                # split into entry ranges
+                nshards = max(1, min(self.nshards or 1, n))
+                shards = []
+                for i in range(nshards): 
+                    (first, last) = (i*n//nshards, (i+1)*n//nshards)
+                    # temp output file for selector
+                    tmpfile = os.path.join(tmpdir, next(tempfile._get_candidate_names()))
+                    log().debug(f"creating output file: {tmpfile}")
+                    shards.append(SelectorCfg(fin=f,fout=tmpfile,fcache=fcache,
+                                              tname=s.treename, nevents=last-first,
+                                              pipeline=self.pipeline, 
+                                              first=first, nshards=nshards, 
+                                              colcache=colcache))
+                # now cache the selectors
+                selector_dict[mvcont][f] = shards 
+            return (fhash, tree, selector_dict[mvcont][f])
+
         for rd in self.drawables: 
             for h in rd.get_component_hists():
                 # store all input components for hist in dict
@@ -232,16 +712,8 @@ class Processor():
                     log().debug(f"sample files: {s.files}")
                     h.components[s] = []
                     
-                    # combine selection from hist and sample
-                    sel = default_cut()
-                    if h.sel: sel = sel & h.sel
-                    if s.sel: sel = sel & s.sel
-            
-                    # combine weight from hist and sample
-                    weight = default_weight()
-                    if not self.noweight: 
-                        if h.weight: weight = weight * h.weight
-                        if s.weight: weight = weight * s.weight
+                    # combine selection and weight from hist and sample
+                    (sel, weight) = self.__get_sel_weight__(h, s)
 
                     # determine multi-valued container group
                     # --------------------------------------
@@ -256,37 +728,12 @@ class Processor():
                         continue
                     elif len(mvconts) == 1: mvcont = list(mvconts)[0]
                     else:                   mvcont = None
-                    if not mvcont in selector_dict: 
-                        selector_dict[mvcont] = dict() 
 
                     # create a component hist for each input file
                     # and add to corresponding selector
                     for f in s.files:
-                        # get and cache input file hash and tree
-                        if f not in file_dict:
-                            fhash = file_hash(f)
-                            tree  = s.get_tree(f)
-                            file_dict[f] = {"hash":fhash, "tree":tree}
-                        else: 
-                            fhash = file_dict[f]["hash"]
-                            tree = file_dict[f]["tree"]
-                            
-                        # get and cache selector for this file and mvcont
-                        if f not in selector_dict[mvcont]:
-                            # temp output file for selector
-                            tmpfile = os.path.join(tmpdir, next(tempfile._get_candidate_names()))
-                            log().debug(f"creating output file: {tmpfile}")
-                            # number of events to process for selector
-                            n = s.get_nevents(f)
-                            if event_frac: n = int(event_frac*float(n))
-                            # cache path for this input file  
-                            fcache = os.path.join(os.getenv('HOME'), ".lokicache", f"{fhash}.root")
-                            # now cache the selector and tree
-                            scfg = SelectorCfg(fin=f,fout=tmpfile,fcache=fcache,
-                                               tname=s.treename, nevents=n)
-                            selector_dict[mvcont][f] = scfg 
-                        else: 
-                            scfg = selector_dict[mvcont][f]
+                        (fhash, tree, shards) = get_shards(s, f, mvcont)
+                        scfg = shards[0]
 
 
                         # init vars using current tree
@@ -303,12 +750,14 @@ class Processor():
             
                         # check for cached hist
                         cached = False
+                        tcache = time.time()
                         if self.usecache and os.path.exists(scfg.fcache): 
                             fcache = ROOT.TFile.Open(scfg.fcache)
                             if fcache and fcache.Get(hhash): 
-                                h.components[s] += [{"file":scfg.fcache, "hash":hhash, "cached":True}]
+                                h.components[s] += [{"file":scfg.fcache, "hash":hhash, "fin":f, "cached":True}]
                                 cached = True                            
                             fcache.Close()
+                        tcache_lookup += time.time() - tcache
                         
                         # prepare job if not cached           
                         if not cached: 
@@ -325,24 +774,72 @@ class Processor():
                                            zexpr=zexpr, zbins=zbins,
                                            wexpr = weight.get_expr(),
                                            sexpr = sel.get_expr(),
+                                           eff = h.eff,
                                            )
                             log().debug(f"adding hist: {h.name}, hash: {hhash}")
-                            scfg.add(hcfg)
-                            h.components[s] += [{"file":scfg.fout, "hash":hhash}]
+                            for scfg in shards: 
+                                scfg.add(hcfg)
+                                h.components[s] += [{"file":scfg.fout, "hash":hhash, "fin":f}]
+
+        # flat ntuples (never cached), written by the same selectors
+        for nt in (self.ntups if ntups else []): 
+            nt["parts"] = []
+            for s in nt["sample"].get_final_daughters():
+                if not s.files: 
+                    log().warn(f"Sample {s.name} has no input files, skipping...")
+                    continue
+                sel = default_cut()
+                if nt["sel"]: sel = sel & nt["sel"]
+                if s.sel: sel = sel & s.sel
+                weight = s.weight if nt["useweight"] else None
+                scale = s.get_scale() if nt["useweight"] and s.scaler else 1.
+                invars = nt["invars"]
+                mvconts = set([c for v in invars + [sel, weight] if v for c in v.get_mvinconts()])
+                if len(mvconts) >= 2: 
+                    log().error(f"Ntuple {nt['fout']} has multiple multi-valued containers, skipping {s.name}")
+                    continue
+                mvcont = list(mvconts)[0] if mvconts else None
+                for f in s.files: 
+                    (fhash, tree, shards) = get_shards(s, f, mvcont)
+                    for v in invars + [sel, weight]: 
+                        if v: v.tree_init(tree)
+                    for scfg in shards: 
+                        tmpfile = os.path.join(tmpdir, next(tempfile._get_candidate_names()))
+                        scfg.ntups.append(NtupCfg(fout=tmpfile, tname=nt["sample"].treename, 
+                            names=[v.get_name() for v in invars], 
+                            exprs=[v.get_expr() for v in invars], 
+                            sexpr=sel.get_expr(), 
+                            wexpr=weight.get_expr() if weight else None, 
+                            scale=scale, 
+                            types=[v.get_leaftype() for v in invars], 
+                            compress=nt["compress"]))
+                        nt["parts"].append(tmpfile)
 
         # Remove selectors with no inputs (b/c cached versions were available)
         selectors = [scfg for sublist in selector_dict.values() 
-                          for scfg in sublist.values() if scfg.hists]        
+                          for shards in sublist.values() 
+                          for scfg in shards if scfg.hists or scfg.ntups]        
+        if self.telemetry: 
+            self.telemetry.phases["cache_lookup"] = tcache_lookup
         return selectors
 
     #__________________________________________________________________________=buf=
-    def __process_selectors__(self, selectors):
-        """Process selectors using pool of worker threads"""
+    def __process_selectors__(self, selectors, callback=None):
+        """Process selectors using pool of worker threads
+        
+        If *callback* is provided, it is called every *preview_interval* 
+        seconds if further selectors have finished in the meantime. 
+        The outputs of the finished selectors of this call are tracked 
+        in *completed* (see :func:`__finalize_outputs__`). 
+        """
+        self.completed = set()
 
         # determine number of cores
         if not self.ncores:   ncores = min(2, cpu_count())
         elif self.ncores < 0: ncores = max(1, cpu_count() + self.ncores)
         else:                 ncores = min(self.ncores, cpu_count())
+        client = self.__get_daemon__() or self.executor
+        if client: ncores = client.ncores
         
         # print job stats
         nfiles      = len(set([s.fin for s in selectors]))
@@ -364,32 +861,79 @@ class Processor():
         log().info(f"  cached     : {nhist_cached}")
         log().info(f"  total      : {nhist_total}")
         log().info(f"")
+        tel = self.telemetry
+        if tel: 
+            tel.set(ncores=ncores, nfiles=nfiles, nevents_requested=nev, 
+                    hists_processed=nhist_proc, hists_duplicate=nhist_dup, 
+                    cache_hits=nhist_cached, hists_total=nhist_total)
         
-        # compile cpp classes (must be done before sending jobs)
-        load_cpp_classes()
+        with self.__phase__("dispatch"):
+            ti = time.time()
+            prog = ProgressBar(ntotal=nev,text="Processing hists") if log().level >= logging.INFO else None         
+            # send jobs to warm daemon or executor (batch acts as pool and monitor)
+            if client: 
+                pool = monitor = client.submit(selectors, ncores)
+                results = list(pool.results)
+            else: 
+                # compile cpp classes (must be done before sending jobs)
+                load_cpp_classes()
         
-        # create pool and unleash the fury
-        ti = time.time()
-        prog = ProgressBar(ntotal=nev,text="Processing hists") if log().level >= logging.INFO else None         
-        pool = Pool(processes=ncores)
-        results = [pool.apply_async(process_selector, (s,)) for s in selectors]
+                # create pool and unleash the fury
+                monitor = ProgressMonitor(ncores)
+                pool = Pool(processes=ncores, initializer=init_worker, initargs=(monitor,))
+                results = [pool.apply_async(process_selector, (s,)) for s in selectors]
                 
         nproc=0
+        nbytes = 0
         nhist_tot = 0
         nhist_cached = 0
-        while results: 
-            for r in results:
-                if r.ready():
-                    scfg = r.get()
-                    nproc+=scfg.nevents
-                    if self.usecache:
-                        (ntot,ncache) = self.__cache_selector__(scfg)
-                        nhist_tot += ntot
-                        nhist_cached += ncache
-                    results.remove(r)                    
-            time.sleep(1)
-            if prog: prog.update(nproc)
-        if prog: prog.finalize()
+        rate = RateEstimator()
+        byterate = RateEstimator()
+        shards = dict()
+        tcallback = time.time()
+        ncallback = 0
+        with self.__phase__("processing"):
+            while results: 
+                for r in results:
+                    if r.ready():
+                        scfg = r.get()
+                        nproc+=scfg.nevents
+                        if scfg.stats: nbytes += scfg.stats.get("bytes_read", 0)
+                        self.completed.add(scfg.fout)
+                        if tel and scfg.stats: 
+                            tel.add_job(scfg.stats, name=os.path.basename(scfg.fin))
+                        # shards are cached together once the whole file is done
+                        done = [scfg]
+                        if scfg.nshards > 1: 
+                            done = shards.setdefault((scfg.fin, scfg.fcache, tuple(scfg.hists)), [])
+                            done.append(scfg)
+                            if len(done) < scfg.nshards: done = None
+                        if self.usecache and done:
+                            with self.__phase__("caching"):
+                                (ntot,ncache) = self.__cache_selector__(done)
+                            nhist_tot += ntot
+                            nhist_cached += ncache
+                        results.remove(r)                    
+                time.sleep(1)
+                # live progress from workers
+                nlive = nproc + monitor.get_entries()
+                evrate = rate.update(nlive)
+                readrate = byterate.update(nbytes + monitor.get_bytes())
+                if tel: tel.add_counter("throughput", {"events_per_s": evrate, "bytes_per_s": readrate})
+                for slot in monitor.get_new_stalls(self.stall_time):
+                    if prog: prog.finalize()
+                    log().warn(f"Worker {slot} stalled (no progress for > {self.stall_time:.0f} s)")
+                if prog: 
+                    prog.update(nlive, info=format_rate_info(evrate, nev - nlive, monitor, readrate))
+                # partial updates
+                if (callback and results and len(self.completed) > ncallback 
+                        and time.time() - tcallback > self.preview_interval):
+                    if prog: prog.finalize()
+                    callback()
+                    tcallback = time.time()
+                    ncallback = len(self.completed)
+            if prog: prog.finalize()
+        pool.close()
         tf = time.time()
         dt = tf-ti
         log().info(f"Hist processing time: {dt:.1f} s")
@@ -397,9 +941,30 @@ class Processor():
             log().info(f"Cached {nhist_cached} / {nhist_tot} hists!")
 
     #__________________________________________________________________________=buf=
-    def __cache_selector__(self, scfg):
-        """Save tmp hists from selector into permanent cache files""" 
-        fin_name = scfg.fout 
+    def __get_daemon__(self):
+        """Return :class:`~loki.core.daemon.DaemonClient` if daemon requested and reachable
+        
+        The number of daemon workers is stored in the client's *ncores*.
+        """
+        if not self.daemon: return None
+        from loki.core.daemon import DaemonClient
+        client = DaemonClient(None if self.daemon is True else self.daemon)
+        try: 
+            client.ncores = client.status()["ncores"]
+        except Exception as e: 
+            log().warn(f"Couldn't reach processing daemon at {client.address} ({e}), using local pool")
+            return None
+        log().info(f"Using processing daemon at {client.address}")
+        return client
+
+    #__________________________________________________________________________=buf=
+    def __cache_selector__(self, scfgs):
+        """Save tmp hists from selectors into permanent cache files
+        
+        *scfgs* are the selectors (shards) processing the same input file, 
+        their hists are summed. 
+        """ 
+        scfg = scfgs[0]
         fout_name = scfg.fcache
         # ensure cache dir exists
         fout_dir = os.path.dirname(fout_name)
@@ -427,23 +992,28 @@ class Processor():
                     log().warn(f"Failure opening cache: {ftmp_name}")
                     raise IOError
                 
-                # open input
-                fin = ROOT.TFile.Open(fin_name)
-                if not fin: 
-                    log().warn(f"Failure opening tmp: {fin_name}")
-                    raise IOError
+                # open inputs
+                fins = []
+                for fin_name in [sc.fout for sc in scfgs]: 
+                    fin = ROOT.TFile.Open(fin_name)
+                    if not fin: 
+                        log().warn(f"Failure opening tmp: {fin_name}")
+                        raise IOError
+                    fins.append(fin)
                 
-                # copy hists from input to tmp
+                # copy (summed) hists from inputs to tmp
                 for hhash in scfg.hists:
-                    h = fin.Get(hhash)
-                    if not h: 
-                        log().warn(f"Couldn't get {hhash} from {fin_name}")
+                    hs = [fin.Get(hhash) for fin in fins]
+                    if not all(hs): 
+                        log().warn(f"Couldn't get {hhash} from {scfg.fout}")
                         continue
+                    h = hs[0]
+                    for h2 in hs[1:]: h.Add(h2)
                     ftmp.WriteTObject(h)
                     nhist_cached+=1
                 
                 # close, move back and cleanup
-                fin.Close()
+                for fin in fins: fin.Close()
                 ftmp.Close()
                 if os.path.exists(fout_name):
                     os.remove(fout_name)
@@ -459,34 +1029,89 @@ class Processor():
 
 
     #__________________________________________________________________________=buf=
-    def __finalize_outputs__(self):
-        """Merge component hists and construct higher-level RootDrawable objects"""
+    def __finalize_outputs__(self, preview=False, ntups=True):
+        """Merge component hists and construct higher-level RootDrawable objects
+        (and write the registered ntuples if *ntups*, except in *preview*)
+        
+        If *preview*, input files whose components have not all been 
+        processed yet are substituted by their (scaled) preview components. 
+        Components are matched by input file rather than by position, since 
+        the number of components per file differs between the passes (cached 
+        hists, number of shards). 
+        """
         event_frac = self.__discritize_event_frac__(self.event_frac)
-        # group and merge all the outputs
+        preview_frac = self.__discritize_event_frac__(self.preview) if preview else None
+        # group and merge all the outputs (hists shared between drawables 
+        # are only merged once, component files are only opened once)
+        merged = set()
+        files = dict()
         for rd in self.drawables:
             for h in rd.get_component_hists():
+                if id(h) in merged: continue
+                merged.add(id(h))
                 rootobj = h.new_hist()
                 h.set_rootobj(rootobj)
                 for (s, components) in h.components.items():
                     # scale
-                    if not self.noweight and s.scaler: 
-                        scale = s.get_scale()
-                        if event_frac: scale/=event_frac
-                    else: 
-                        scale = None
+                    scale = self.__get_scale__(s, event_frac, event_frac)
+                    parts = [(c, scale) for c in components]
+                    if preview: 
+                        preview_scale = self.__get_scale__(s, preview_frac, event_frac)
+                        previews = group_components(h.preview_components.get(s, []))
+                        parts = []
+                        for (fin, fcomponents) in group_components(components).items(): 
+                            if all([c.get("cached", False) or c["file"] in self.completed 
+                                    for c in fcomponents]): 
+                                parts += [(c, scale) for c in fcomponents]
+                            else: 
+                                parts += [(c, preview_scale) for c in previews.get(fin, [])]
                                    
                     # merge sub-objects (from each file)
-                    for c in components: 
-                        f = ROOT.TFile.Open(c["file"])
+                    for (c, cscale) in parts: 
+                        f = files.get(c["file"])
+                        if f is None: 
+                            f = files[c["file"]] = ROOT.TFile.Open(c["file"])
+                            # keep new hists out of the open file
+                            ROOT.gROOT.cd()
                         o = f.Get(c["hash"]).Clone()
-                        if scale: o.Scale(scale)
+                        o.SetDirectory(0)
+                        if cscale: o.Scale(cscale)
                         rootobj.Add(o)
-                        f.Close()
+        for f in files.values(): f.Close()
+        # build drawables (memoised: shared inputs are only built once)
+        for rd in self.drawables: 
             rd.build_rootobj()
-            
-        # accounting
-        self.processed_drawables += self.drawables
-        self.drawables = []
+        if ntups and not preview: 
+            self.__finalize_ntups__()
+
+    #__________________________________________________________________________=buf=
+    def __finalize_ntups__(self):
+        """Merge the parts of each registered flat ntuple into its output file"""
+        for nt in self.ntups: 
+            if not nt["parts"]: 
+                log().warn(f"No inputs for ntuple {nt['fout']}")
+                continue
+            mkdir_p(os.path.dirname(os.path.abspath(nt["fout"])))
+            ch = ROOT.TChain(nt["sample"].treename)
+            for part in nt["parts"]: ch.Add(part)
+            ch.Merge(nt["fout"], "fast")
+            log().info(f"Output tree written to {nt['fout']}")
+
+    #__________________________________________________________________________=buf=
+    def __get_scale__(self, s, event_frac, ref_frac=None):
+        """Return scale for components of sample *s* processed with *event_frac*
+        
+        Unscaled samples (or if *noweight*) are only scaled if *event_frac* 
+        differs from the reference fraction *ref_frac* (eg. for preview 
+        components merged with full-statistics components).
+        """
+        if not self.noweight and s.scaler: 
+            scale = s.get_scale()
+            if event_frac: scale/=event_frac
+            return scale
+        if event_frac != ref_frac: 
+            return (ref_frac or 1.) / (event_frac or 1.)
+        return None
 
     #__________________________________________________________________________=buf=
     def __get_nhist_total__(self):
@@ -510,9 +1135,144 @@ class Processor():
         return n
 
 
+#------------------------------------------------------------------------------=buf=
+class ProgressMonitor(object):
+    """Shared-memory progress slots for the :class:`Processor` worker pool
+    
+    Each worker process claims one slot on start-up (see :func:`init_worker`). 
+    Slots are owned by the worker pid, and the slot of a dead worker (eg. 
+    after a crash) is reclaimed by its replacement (see :meth:`claim`). 
+    During processing the LokiSelector writes the number of processed entries, 
+    the bytes read and the time of the last update into the slot every 
+    LokiSelector::kMonInterval entries. The driver reads the slots to report 
+    live throughput and to detect stalled workers. 
+    
+    Slot layout (doubles): entries, bytes read, last update time, busy flag, 
+    resident set size [bytes]. The entries, bytes, time and rss fields match 
+    LokiSelector::kMonEntries/kMonBytes/kMonTime/kMonRSS.
+
+    :param nslots: number of slots (ie. workers)
+    :type nslots: int
+    """
+    nfields = 5
+    ENTRIES, BYTES, TIME, BUSY, RSS = range(nfields)
+    #__________________________________________________________________________=buf=
+    def __init__(self, nslots):
+        self.nslots = nslots
+        self.data = RawArray('d', nslots * self.nfields)
+        self.owners = RawArray('l', nslots)
+        self.lock = Lock()
+        self.stalled = set()
+
+    #__________________________________________________________________________=buf=
+    def claim(self):
+        """Claim a free slot for the current process (called on worker)
+        
+        Slots owned by processes that no longer exist are free. 
+        Returns None if all slots are owned by live processes. 
+        """
+        pid = os.getpid()
+        with self.lock: 
+            for i in range(self.nslots): 
+                if self.owners[i] and self.owners[i] != pid and pid_alive(self.owners[i]): 
+                    continue
+                self.owners[i] = pid
+                self.stop(i)
+                return i
+        return None
+
+    #__________________________________________________________________________=buf=
+    def get_address(self, slot):
+        """Return memory address of *slot* (passed to LokiSelector::SetMonitor)"""
+        return ctypes.addressof(self.data) + slot * self.nfields * ctypes.sizeof(ctypes.c_double)
+
+    #__________________________________________________________________________=buf=
+    def get(self, slot, field):
+        """Return value of *field* in *slot*"""
+        return self.data[slot * self.nfields + field]
+
+    #__________________________________________________________________________=buf=
+    def start(self, slot):
+        """Reset *slot* at start of a selector job (called on worker)"""
+        i = slot * self.nfields
+        self.data[i+self.ENTRIES] = 0.
+        self.data[i+self.BYTES] = 0.
+        self.data[i+self.TIME] = time.time()
+        self.data[i+self.BUSY] = 1.
+
+    #__________________________________________________________________________=buf=
+    def stop(self, slot):
+        """Reset *slot* at end of a selector job (called on worker)
+        
+        The entries and bytes are cleared, since the completed job is 
+        accounted for by the driver once the result is collected.
+        """
+        i = slot * self.nfields
+        self.data[i+self.BUSY] = 0.
+        self.data[i+self.ENTRIES] = 0.
+        self.data[i+self.BYTES] = 0.
+
+    #__________________________________________________________________________=buf=
+    def get_entries(self):
+        """Return total number of entries processed by running jobs"""
+        return int(sum([self.get(i, self.ENTRIES) for i in range(self.nslots)]))
+
+    #__________________________________________________________________________=buf=
+    def get_bytes(self):
+        """Return total number of bytes read by running jobs"""
+        return sum([self.get(i, self.BYTES) for i in range(self.nslots)])
+
+    #__________________________________________________________________________=buf=
+    def get_rss(self):
+        """Return largest resident set size [bytes] of the busy workers"""
+        return max([self.get(i, self.RSS) for i in range(self.nslots) if self.get(i, self.BUSY)] or [0.])
+
+    #__________________________________________________________________________=buf=
+    def get_busy(self):
+        """Return number of busy workers"""
+        return sum([1 for i in range(self.nslots) if self.get(i, self.BUSY)])
+
+    #__________________________________________________________________________=buf=
+    def get_new_stalls(self, stall_time):
+        """Return list of busy slots newly stalled for longer than *stall_time* [s]"""
+        tnow = time.time()
+        stalled = set([i for i in range(self.nslots) if self.get(i, self.BUSY) 
+                       and tnow - self.get(i, self.TIME) > stall_time])
+        new = sorted(stalled - self.stalled)
+        self.stalled = stalled
+        return new
+
+
+#------------------------------------------------------------------------------=buf=
+class RateEstimator(object):
+    """Exponentially smoothed rate estimate (eg. events or bytes read)
+    
+    :param alpha: smoothing factor (weight of the latest measurement)
+    :type alpha: float
+    """
+    #__________________________________________________________________________=buf=
+    def __init__(self, alpha=0.3):
+        self.alpha = alpha
+        self.rate = None
+        self.last = None
+
+    #__________________________________________________________________________=buf=
+    def update(self, n):
+        """Update with current count *n* and return smoothed rate [1/s]"""
+        t = time.time()
+        if self.last: 
+            (n0, t0) = self.last
+            if t > t0: 
+                r = max(0., (n - n0) / (t - t0))
+                self.rate = r if self.rate is None else self.alpha * r + (1. - self.alpha) * self.rate
+        self.last = (n, t)
+        return self.rate or 0.
+
+
 #------------------------------------------------------------------------------=buf=
 class HistCfg(object):
-    """Simple python class to store blueprints for cpp compiled LokiHist1D/2D/3D.
+    """Simple python class to store blueprints for cpp compiled LokiHist1D/2D/3D
+    (or LokiEff, for the paired pass/total components of an efficiency, see :func:`pair_eff_cfgs`).
     
     The HistCfg objects are collected in an instance of :class:`SelectorCfg`. 
     
@@ -524,7 +1284,7 @@ class HistCfg(object):
                  xexpr=None, xbins=None, 
                  yexpr=None, ybins=None,
                  zexpr=None, zbins=None,
-                 sexpr=None, wexpr=None):
+                 sexpr=None, wexpr=None, eff=None):
         # attributes
         self.hash = hash
         self.xexpr = xexpr
@@ -535,6 +1295,56 @@ class HistCfg(object):
         self.zbins = zbins
         self.sexpr = sexpr
         self.wexpr = wexpr
+        self.eff = eff
+
+    #__________________________________________________________________________=buf=
+    def to_dict(self):
+        """Return hist config as json-serialisable dict (see :func:`write_job_spec`)"""
+        d = dict(self.__dict__)
+        for k in ["xbins", "ybins", "zbins", "eff"]: 
+            if d[k] is not None: d[k] = list(d[k])
+        return d
+
+    #__________________________________________________________________________=buf=
+    @classmethod
+    def from_dict(cls, d):
+        """Return hist config from dict *d* (see :func:`to_dict`)"""
+        h = cls(**dict([(k, d.get(k)) for k in cls().__dict__]))
+        if h.eff is not None: h.eff = tuple(h.eff)
+        return h
+
+
+#------------------------------------------------------------------------------=buf=
+class NtupCfg(object):
+    """Simple python class to store blueprints for cpp compiled LokiNtup
+    (flat ntuple written by the selector, see :func:`Processor.register_ntup`).
+    
+    The NtupCfg objects are collected in an instance of :class:`SelectorCfg`. 
+    """
+    #__________________________________________________________________________=buf=
+    def __init__(self, fout=None, tname=None, names=None, exprs=None, 
+                 sexpr=None, wexpr=None, scale=1., types=None, compress=None):
+        # attributes
+        self.fout = fout
+        self.tname = tname
+        self.names = names or []
+        self.exprs = exprs or []
+        self.sexpr = sexpr
+        self.wexpr = wexpr
+        self.scale = scale
+        self.types = types or []
+        self.compress = compress
+
+    #__________________________________________________________________________=buf=
+    def to_dict(self):
+        """Return ntuple config as json-serialisable dict (see :func:`write_job_spec`)"""
+        return dict(self.__dict__)
+
+    #__________________________________________________________________________=buf=
+    @classmethod
+    def from_dict(cls, d):
+        """Return ntuple config from dict *d* (see :func:`to_dict`)"""
+        return cls(**dict([(k, d.get(k)) for k in cls().__dict__ if k in d]))
 
 
 #------------------------------------------------------------------------------=buf=
@@ -545,13 +1355,20 @@ class SelectorCfg(object):
     (to the :func:`process_selector`).      
     """
     #__________________________________________________________________________=buf=
-    def __init__(self, fin=None, fout=None, fcache=None, tname=None, nevents=None):
+    def __init__(self, fin=None, fout=None, fcache=None, tname=None, nevents=None, 
+                 pipeline=False, first=0, nshards=1, colcache=None):
         self.fin = fin 
         self.fout = fout
         self.fcache = fcache
         self.tname = tname
         self.nevents = nevents
+        self.pipeline = pipeline
+        self.first = first
+        self.nshards = nshards
+        self.colcache = colcache
         self.hists = dict()
+        self.ntups = []
+        self.stats = None
 
     #__________________________________________________________________________=buf=
     def add(self, h):
@@ -563,6 +1380,74 @@ class SelectorCfg(object):
         if h.hash not in self.hists: 
             self.hists[h.hash] = h 
 
+    #__________________________________________________________________________=buf=
+    def to_dict(self):
+        """Return selector config as json-serialisable dict (see :func:`write_job_spec`)
+        
+        Besides the hist configs, the dict lists the hashes of the paired 
+        efficiency components under "effs" (see :func:`pair_eff_cfgs`), so 
+        that the standalone executor fills them with a single LokiEff. 
+        """
+        (pairs, others) = pair_eff_cfgs(self.hists)
+        return {"fin": self.fin, "fout": self.fout, "fcache": self.fcache, 
+                "tname": self.tname, "nevents": self.nevents, 
+                "pipeline": self.pipeline, "first": self.first, "nshards": self.nshards, 
+                "colcache": self.colcache, 
+                "hists": [h.to_dict() for h in self.hists.values()], 
+                "effs": [[p.hash, t.hash] for (p, t) in pairs], 
+                "ntups": [n.to_dict() for n in self.ntups]}
+
+    #__________________________________________________________________________=buf=
+    @classmethod
+    def from_dict(cls, d):
+        """Return selector config from dict *d* (see :func:`to_dict`)"""
+        scfg = cls(fin=d["fin"], fout=d["fout"], fcache=d.get("fcache"), 
+                   tname=d["tname"], nevents=d.get("nevents"), 
+                   pipeline=d.get("pipeline", False), first=d.get("first", 0), 
+                   nshards=d.get("nshards", 1), colcache=d.get("colcache"))
+        for h in d.get("hists", []): scfg.add(HistCfg.from_dict(h))
+        scfg.ntups = [NtupCfg.from_dict(n) for n in d.get("ntups", [])]
+        return scfg
+
+
+#______________________________________________________________________________=buf=
+def init_worker(monitor):
+    """Initialize worker process, claiming a slot in the progress *monitor*"""
+    global _worker_monitor, _worker_slot
+    _worker_slot = monitor.claim()
+    _worker_monitor = monitor if _worker_slot is not None else None
+
+
+#______________________________________________________________________________=buf=
+def pid_alive(pid):
+    """Return True if process *pid* exists"""
+    try:
+        os.kill(pid, 0)
+    except ProcessLookupError: 
+        return False
+    except PermissionError: 
+        pass
+    return True
+
+
+#______________________________________________________________________________=buf=
+def format_rate_info(rate, nleft, monitor, readrate=0.):
+    """Return progress info string with event rate, ETA, read rate, busy, memory and stalled workers
+    
+    The read rate [bytes/s] (from the bytes read published by the selectors, 
+    see :class:`ProgressMonitor`) helps to spot slow storage. 
+    """
+    info = f"{rate/1000.:.1f} kev/s"
+    if rate > 0.: 
+        eta = int(max(0, nleft) / rate)
+        info += f", ETA {eta//3600:d}:{eta%3600//60:02d}:{eta%60:02d}"
+    if readrate > 0.: info += f", {readrate/1024.**2:.1f} MB/s"
+    info += f", {monitor.get_busy()} busy"
+    rss = monitor.get_rss()
+    if rss: info += f", {rss/1024.**2:.0f} MB rss"
+    if monitor.stalled: info += f", {len(monitor.stalled)} stalled"
+    return info
+
 
 #______________________________________________________________________________=buf=
 def process_selector(scfg):
@@ -577,54 +1462,374 @@ def process_selector(scfg):
     
     """
     # configure 
+    ts = now()
     nevents = scfg.nevents
     if not nevents: 
         if ROOT.gROOT.GetVersion() < '6.00': nevents = 1000000000  
         else:                                nevents = ROOT.TTree.kMaxEntries     
 
     # get input
-    fin = ROOT.TFile.Open(scfg.fin)
+    fin = open_input(scfg.fin)
     if not fin: 
         return
+    bytes0 = fin.GetBytesRead()
     ch = fin.Get(scfg.tname)
     if not ch: 
-        fin.Close()
+        release_input(fin)
         return
     
     # load cpp classes
     load_cpp_classes()
-    from ROOT import LokiSelector, LokiHist1D, LokiHist2D, LokiHist3D
+    from ROOT import LokiSelector, LokiNtup
 
-    # configure selector
+    # configure selector (hists are booked in a single call)
     selector = LokiSelector(scfg.fout)
-    for (hash, hcfg) in scfg.hists.items():
-        h = None
-        if hcfg.zexpr and hcfg.yexpr and hcfg.xexpr:
-            h = LokiHist3D(hash,
-                hcfg.xexpr, get_xbins_stdvec(hcfg.xbins),
-                hcfg.yexpr, get_xbins_stdvec(hcfg.ybins),
-                hcfg.zexpr, get_xbins_stdvec(hcfg.zbins),
-                hcfg.sexpr, hcfg.wexpr)
-        elif hcfg.yexpr and hcfg.xexpr: 
-            h = LokiHist2D(hash, 
-                hcfg.xexpr, get_xbins_stdvec(hcfg.xbins),
-                hcfg.yexpr, get_xbins_stdvec(hcfg.ybins),
-                hcfg.sexpr, hcfg.wexpr)
-        elif hcfg.xexpr and not hcfg.zexpr: 
-            h = LokiHist1D(hash, 
-                hcfg.xexpr, get_xbins_stdvec(hcfg.xbins),
-                hcfg.sexpr, hcfg.wexpr)
-        
-        if h: selector.AddHist(h)
+    selector.SetPipeline(scfg.pipeline)
+    if scfg.colcache: selector.SetColumnCache(scfg.colcache)
+    (strs, table, edges) = pack_booking(scfg.hists)
+    if table: 
+        nrows = len(table) // BOOK_FIELDS
+        if selector.Book(strs, len(strs), table, nrows, edges, len(edges)) != nrows: 
+            raise ValueError(f"Failed booking hists for {scfg.fin}")
+    for ncfg in scfg.ntups: 
+        ntup = LokiNtup(ncfg.fout, ncfg.tname, 
+            get_stdvec(ncfg.names, "string"), get_stdvec(ncfg.exprs, "string"), 
+            ncfg.sexpr or "", ncfg.wexpr or "", ncfg.scale)
+        if ncfg.types: ntup.SetTypes(get_stdvec(ncfg.types, "string"))
+        if ncfg.compress is not None: ntup.SetCompression(ncfg.compress)
+        selector.AddNtup(ntup)
     
+    # attach live progress monitor
+    if _worker_monitor: 
+        _worker_monitor.start(_worker_slot)
+        selector.SetMonitor(_worker_monitor.get_address(_worker_slot))
+
     # unleash the fury
-    ch.Process(selector, "", nevents)
+    ch.Process(selector, "", nevents, scfg.first)
+    if _worker_monitor: _worker_monitor.stop(_worker_slot)
     
     # finish up
-    fin.Close()
+    mb = 1024.**2
+    scfg.stats = job_stats(ts, nevents=min(nevents, ch.GetEntries() - scfg.first), 
+                           bytes_read=fin.GetBytesRead() - bytes0, nhists=len(scfg.hists), 
+                           cache_reads=selector.GetCacheReads(), 
+                           rss_start_mb=selector.GetStartRSS()/mb, rss_mb=selector.GetRSS()/mb, 
+                           selector_peak_rss_mb=selector.GetPeakRSS()/mb)
+    release_input(fin)
     return scfg
 
 
+#______________________________________________________________________________=buf=
+def pack_booking(hists):
+    """Return packed booking table for LokiSelector::Book
+    
+    Packs the hist configs into three flat buffers, so that all hists 
+    are booked with a single call into c++ rather than one construction 
+    and AddHist call per hist: 
+    
+    * strs: the distinct hashes and expressions, separated by null bytes 
+    * table: *BOOK_FIELDS* ints per hist (see EBookField in LokiSelector.h), 
+      referring to strings by index and to bin edges by offset and length
+    * edges: the distinct binnings, concatenated
+    
+    Paired efficiency components (see :func:`pair_eff_cfgs`) are booked 
+    as a single LokiEff. 
+    
+    :param hists: hist configs (key: hash)
+    :type hists: dict (str, :class:`HistCfg`)
+    :rtype: tuple (bytes, array('i'), array('f'))
+    """
+    strs = dict()
+    bins = dict()
+    table = array('i')
+    edges = array('f')
+    def sid(x): 
+        if not x: return -1
+        return strs.setdefault(x, len(strs))
+    def eid(b): 
+        if not b: return (-1, 0)
+        key = tuple(b)
+        if key not in bins: 
+            bins[key] = (len(edges), len(key))
+            edges.extend(key)
+        return bins[key]
+    def row(kind, h, hash2=None, sel2=None): 
+        table.extend([kind, sid(h.hash), sid(hash2), sid(h.xexpr), sid(h.yexpr), sid(h.zexpr), 
+                      sid(h.sexpr), sid(sel2), sid(h.wexpr)])
+        table.extend(eid(h.xbins) + eid(h.ybins) + eid(h.zbins))
+    
+    (effs, hcfgs) = pair_eff_cfgs(hists)
+    for (hpass, htotal) in effs: 
+        row(4, hpass, hash2=htotal.hash, sel2=htotal.sexpr)
+    for hcfg in hcfgs.values(): 
+        if hcfg.zexpr and hcfg.yexpr and hcfg.xexpr:  row(3, hcfg)
+        elif hcfg.yexpr and hcfg.xexpr:               row(2, hcfg)
+        elif hcfg.xexpr and not hcfg.zexpr:           row(1, hcfg)
+    return ("\0".join(strs).encode(), table, edges)
+
+
+#______________________________________________________________________________=buf=
+def keep_input_files(max_files):
+    """Keep up to *max_files* input files open in the current worker process
+    
+    Used by the :class:`~loki.core.daemon.ProcessingDaemon` workers, so 
+    that repeated jobs on the same file reuse the open file and tree. 
+    """
+    global _worker_files, _worker_max_files
+    _worker_files = OrderedDict()
+    _worker_max_files = max_files
+
+
+#______________________________________________________________________________=buf=
+def open_input(fname):
+    """Return opened input file *fname* (reused if kept open, see :func:`keep_input_files`)
+    
+    Kept files are reopened if their modification time changed, and the 
+    least recently used file is closed if more than *max_files* are open.
+    """
+    if _worker_files is None: 
+        return ROOT.TFile.Open(fname)
+    mtime = os.path.getmtime(fname) if os.path.exists(fname) else None
+    (fin, fmtime) = _worker_files.pop(fname, (None, None))
+    if fin and fmtime != mtime: 
+        fin.Close()
+        fin = None
+    if not fin: 
+        fin = ROOT.TFile.Open(fname)
+        if not fin: return fin
+    _worker_files[fname] = (fin, mtime)
+    while len(_worker_files) > _worker_max_files: 
+        (old, _) = _worker_files.popitem(last=False)[1]
+        old.Close()
+    return fin
+
+
+#______________________________________________________________________________=buf=
+def release_input(fin):
+    """Close input file *fin* unless kept open (see :func:`keep_input_files`)"""
+    if _worker_files is None: 
+        fin.Close()
+
+
+#______________________________________________________________________________=buf=
+def pair_eff_cfgs(hists):
+    """Return list of (pass, total) HistCfg pairs and dict of remaining HistCfgs
+    
+    Pass and total components of the same efficiency (see 
+    :class:`~loki.core.hist.EffProfile`) are paired if they are 1D and 
+    share the same variable, binning and weight, so that they can be 
+    filled together by a single LokiEff. 
+    
+    :param hists: hist configs (key: hash)
+    :type hists: dict (str, :class:`HistCfg`)
+    """
+    groups = dict()
+    for hcfg in hists.values(): 
+        if not hcfg.eff or hcfg.yexpr or hcfg.zexpr: continue
+        (key, role) = hcfg.eff
+        groups.setdefault(key, dict())[role] = hcfg
+    pairs = []
+    for g in groups.values(): 
+        (hpass, htotal) = (g.get("pass"), g.get("total"))
+        if not (hpass and htotal): continue
+        if hpass.xexpr != htotal.xexpr or hpass.wexpr != htotal.wexpr: continue
+        if list(hpass.xbins) != list(htotal.xbins): continue
+        pairs.append((hpass, htotal))
+    paired = set([h.hash for p in pairs for h in p])
+    others = dict([(k, v) for (k, v) in hists.items() if k not in paired])
+    return (pairs, others)
+
+
+#______________________________________________________________________________=buf=
+def write_job_spec(selectors, fname):
+    """Write job spec for the standalone executor (src/lokirun.cxx)
+    
+    The job spec is a compact JSON serialisation of the selector 
+    configurations (format documented in src/LokiJob.h), which can be 
+    processed without python, eg. on batch worker nodes::
+    
+        lokirun job.json [INDEX ...]
+    
+    :param selectors: selector configurations
+    :type selectors: list :class:`SelectorCfg`
+    :param fname: output job spec file name
+    :type fname: str
+    """
+    spec = {"version": JOB_SPEC_VERSION, "selectors": [s.to_dict() for s in selectors]}
+    mkdir_p(os.path.dirname(os.path.abspath(fname)))
+    with open(fname, "w") as f:
+        json.dump(spec, f, separators=(",", ":"))
+
+
+#______________________________________________________________________________=buf=
+def read_job_spec(fname):
+    """Return list of :class:`SelectorCfg` from job spec *fname* (see :func:`write_job_spec`)"""
+    with open(fname) as f:
+        spec = json.load(f)
+    if spec.get("version") != JOB_SPEC_VERSION: 
+        raise ValueError(f"Unsupported job spec version {spec.get('version')} in {fname}")
+    return [SelectorCfg.from_dict(d) for d in spec["selectors"]]
+
+
+#______________________________________________________________________________=buf=
+def group_components(components):
+    """Return hist *components* grouped by input file
+    
+    :param components: component hist configs (see :func:`Processor.__get_selectors__`)
+    :type components: list dict
+    :rtype: OrderedDict (str, list dict)
+    """
+    groups = OrderedDict()
+    for c in components: 
+        groups.setdefault(c["fin"], []).append(c)
+    return groups
+
+
+#______________________________________________________________________________=buf=
+def get_compression_settings(compression):
+    """Return ROOT compression settings for *compression* profile
+    
+    Profiles (see :data:`COMPRESSION_PROFILES`): 
+    
+    * default: ROOT default (returns None)
+    * fast: LZ4, fast decompression for ntuples that are reread many times
+    * small: ZSTD, smallest files
+    
+    Integers are taken as explicit settings (100 * algorithm + level). 
+    
+    :param compression: profile name or settings
+    :type compression: str or int
+    :rtype: int
+    """
+    if compression is None or isinstance(compression, int): 
+        return compression
+    if compression not in COMPRESSION_PROFILES: 
+        raise ValueError(f"Unknown compression profile {compression}, options: {list(COMPRESSION_PROFILES)}")
+    return COMPRESSION_PROFILES[compression]
+
+
+#______________________________________________________________________________=buf=
+def open_output_file(fname, compression=None):
+    """Return new (recreated) output file *fname* with *compression* profile
+    
+    :param fname: file name
+    :type fname: str
+    :param compression: compression profile (see :func:`get_compression_settings`)
+    :type compression: str or int
+    :rtype: ROOT.TFile
+    """
+    settings = get_compression_settings(compression)
+    f = ROOT.TFile.Open(fname, "RECREATE")
+    if f and settings is not None: 
+        f.SetCompressionSettings(settings)
+    return f
+
+
+#______________________________________________________________________________=buf=
+def set_tree_compression(tree, compression):
+    """Set *compression* profile of all branches of *tree*
+    
+    Used before copying a tree (eg. TTree::CopyTree), since the branches 
+    of the copy inherit the compression of the original branches rather 
+    than that of the output file. 
+    
+    :param tree: tree
+    :type tree: ROOT.TTree
+    :param compression: compression profile (see :func:`get_compression_settings`)
+    :type compression: str or int
+    """
+    settings = get_compression_settings(compression)
+    if settings is None: return
+    for br in tree.GetListOfBranches(): 
+        br.SetCompressionSettings(settings)
+
+
+#______________________________________________________________________________=buf=
+def get_colcache_path(fhash=None, treename=None):
+    """Return column cache dir for tree *treename* of the input file with hash *fhash*
+    
+    Returns the top-level cache dir if *fhash* is not given.
+    """
+    path = os.path.join(os.getenv('HOME'), ".lokicache", "columns")
+    if fhash: path = os.path.join(path, fhash)
+    if treename: path = os.path.join(path, treename)
+    return path
+
+
+#______________________________________________________________________________=buf=
+def touch_colcache(fhash, fname):
+    """Mark the column cache of input file *fname* (with hash *fhash*) as used
+    
+    Records the input file path in ``source`` in the cache dir (see 
+    :func:`prune_colcache`) and updates the modification time of the dir. 
+    
+    :param fhash: input file hash (see :func:`file_hash`)
+    :type fhash: str
+    :param fname: input file path
+    :type fname: str
+    """
+    path = get_colcache_path(fhash)
+    mkdir_p(path)
+    with open(os.path.join(path, "source"), "w") as f: 
+        f.write(os.path.abspath(fname) + "\n")
+    os.utime(path)
+
+
+#______________________________________________________________________________=buf=
+def prune_colcache(max_age=30.):
+    """Remove stale column caches from ``~/.lokicache/columns``
+    
+    The cache dirs are keyed by the input file hash (path and modification 
+    time), so a modified input file leaves its old dir behind. A dir is 
+    removed if its recorded input file (see :func:`touch_colcache`) no 
+    longer exists or no longer has this hash, or if it hasn't been used 
+    for *max_age* days. 
+    
+    :param max_age: max time since last use [days]
+    :type max_age: float
+    :returns: number of removed dirs
+    :rtype: int
+    """
+    top = get_colcache_path()
+    if not os.path.isdir(top): return 0
+    tmin = time.time() - max_age * 86400.
+    nremoved = 0
+    for fhash in os.listdir(top): 
+        path = os.path.join(top, fhash)
+        if not os.path.isdir(path): continue
+        stale = os.path.getmtime(path) < tmin
+        fsource = os.path.join(path, "source")
+        if not stale and os.path.exists(fsource):
+            with open(fsource) as f: fname = f.readline().strip()
+            stale = not os.path.exists(fname) or file_hash(fname) != fhash
+        if not stale: continue
+        log().debug(f"Removing stale column cache: {path}")
+        shutil.rmtree(path, ignore_errors=True)
+        nremoved += 1
+    if nremoved: log().info(f"Removed {nremoved} stale column cache(s)")
+    return nremoved
+
+
+#______________________________________________________________________________=buf=
+def get_lokirun_path():
+    """Return path of the standalone executor (built by scripts/build_lokirun.sh)"""
+    return os.path.join(get_project_path(), "build", "lokirun")
+
+
+#______________________________________________________________________________=buf=
+def set_pending(rd, processor):
+    """Mark drawable (or plot) *rd* and its inputs as pending on lazy *processor*
+    
+    Accessing the result of a pending drawable triggers the processor's 
+    :func:`Processor.run`. Pass None to clear the mark. 
+    """
+    if isinstance(rd, Plot): 
+        for r in rd.rds + rd.stack_rds + rd.ratio_rds: set_pending(r, processor)
+        return
+    rd._pending = processor
+    for r in rd.get_inputs(): set_pending(r, processor)
+
+
 #______________________________________________________________________________=buf=
 def tree2arrays(tree, vars, sel=None, lenvar=None, nevents=None):
     """Return dictionary of arrays from TTree 
@@ -690,7 +1895,7 @@ def tree2arrays(tree, vars, sel=None, lenvar=None, nevents=None):
 
 
 #______________________________________________________________________________=buf=
-def array2tree(arr, name, tree):
+def array2tree(arr, name, tree, leaftype=None):
     """Attach array to TTree
     
     :param arr: array 
@@ -699,6 +1904,8 @@ def array2tree(arr, name, tree):
     :type name: str 
     :param tree: tree
     :type tree: ROOT.TTree
+    :param leaftype: ROOT leaf type for new branch (default: from array typecode)
+    :type leaftype: str
     """
     arr_type = arr.typecode
     ref = array(arr_type,[0])
@@ -707,7 +1914,7 @@ def array2tree(arr, name, tree):
         br.SetAddress(ref)
         #log().info(f"Extending existing branch: {name}, entries: {br.GetEntries()}")
     else:
-        root_type = arr_type.capitalize()
+        root_type = leaftype or arr_type.capitalize()
         name_with_type = f"{name}/{root_type}"
         log().debug(f"Creating branch ({name}, {ref}, {name_with_type})")
         #log().info(f"Creating branch ({name}, {ref}, {name_with_type})")
@@ -729,7 +1936,7 @@ def arrays2tree(arrays, tree):
     """
     # register branches
     for (v,a) in arrays:
-        array2tree(a,v.get_newbranch(),tree)
+        array2tree(a,v.get_newbranch(),tree,v.get_leaftype(a.typecode))
 
     # get number of events    
     #nev_set = set([len(a) for (v,a) in arrays])
@@ -743,9 +1950,9 @@ def arrays2tree(arrays, tree):
  
  
 #______________________________________________________________________________=buf=
-def arrays2dmatrix(dsig, dbkg):
-    """Convert sig and bkg numpy arrays to xgb DMatrix"""
-    import numpy, xgboost
+def arrays2matrix(dsig, dbkg):
+    """Convert sig and bkg numpy arrays to (data, label, weight) numpy arrays"""
+    import numpy
     # merge invars
     invars = [v for v in dsig.dtype.names if v != "weight"]
     dmerged = numpy.concatenate([dsig[invars], dbkg[invars]])
@@ -758,10 +1965,24 @@ def arrays2dmatrix(dsig, dbkg):
     weight = numpy.concatenate([wsig, wbkg])
     # label
     label = numpy.concatenate([numpy.ones(len(dsig)), numpy.zeros(len(dbkg))])
+    return (dmerged, label, weight)
+
+#______________________________________________________________________________=buf=
+def arrays2dmatrix(dsig, dbkg):
+    """Convert sig and bkg numpy arrays to xgb DMatrix"""
+    import xgboost
+    (dmerged, label, weight) = arrays2matrix(dsig, dbkg)
     # clean up and construct
-    del dsig, dbkg, wsig, wbkg
+    del dsig, dbkg
     return xgboost.DMatrix(dmerged, label=label, weight=weight)
 
+#______________________________________________________________________________=buf=
+def samples2arrays(sig, bkg, invars=None):
+    """Convert Sig+Bkg TreeData to (data, label, weight) numpy arrays"""
+    dsig = sig.get_ndarray(list(invars))
+    dbkg = bkg.get_ndarray(list(invars))
+    return arrays2matrix(dsig, dbkg)
+
 #______________________________________________________________________________=buf=
 def samples2dmatrix(sig, bkg, invars=None):
     """Convert Sig+Bkg TreeData to xgb DMatrix"""
@@ -843,6 +2064,83 @@ def hist_hash(xvar=None, yvar=None, zvar=None, sel=None, wei=None, event_frac=No
        
     return hash_obj.hexdigest()
 
+#______________________________________________________________________________=buf=
+def hist_meets_precision(h, precision, min_frac=0.):
+    """Return True if the relative uncertainty in all significant bins of *h* is below *precision*
+    
+    Under/overflow bins and bins with content below *min_frac* of the 
+    maximum bin content are ignored. Empty hists never meet the target. 
+    
+    :param h: histogram
+    :type h: :class:`ROOT.TH1`
+    :param precision: target relative uncertainty
+    :type precision: float
+    :param min_frac: relative threshold for significant bins
+    :type min_frac: float
+    """
+    import numpy as np
+    if not h: return False
+    c = bin_contents(h)
+    inner = tuple([slice(1, -1)] * c.ndim)
+    c = np.abs(c[inner], dtype=np.float64)
+    cmax = c.max() if c.size else 0.
+    if cmax <= 0.: return False
+    sig = (c > 0.) & (c >= min_frac * cmax)
+    return bool(np.all(bin_errors(h)[inner][sig] <= precision * c[sig]))
+
+
+#______________________________________________________________________________=buf=
+def graph_meets_precision(g, precision):
+    """Return True if the y-uncertainty of all points in *g* is below *precision*
+    
+    :param g: graph
+    :type g: :class:`ROOT.TGraph`
+    :param precision: target absolute uncertainty
+    :type precision: float
+    """
+    if not g or g.GetN() == 0: return False
+    for i in range(g.GetN()):
+        if max(g.GetErrorYhigh(i), g.GetErrorYlow(i)) > precision: return False
+    return True
+
+
+#______________________________________________________________________________=buf=
+def get_precision_record_path():
+    """Return path to record of event fractions used to meet precision targets"""
+    return os.path.join(os.getenv('HOME'), ".lokicache", "precision.json")
+
+
+#______________________________________________________________________________=buf=
+def read_precision_record():
+    """Return dict of event fractions used to meet precision targets (by job key)"""
+    fname = get_precision_record_path()
+    if not os.path.exists(fname): return dict()
+    try: 
+        with open(fname) as f: 
+            return json.load(f)
+    except (IOError, ValueError): 
+        log().warn(f"Couldn't read precision record: {fname}")
+        return dict()
+
+
+#______________________________________________________________________________=buf=
+def write_precision_record(key, frac):
+    """Record event fraction *frac* used to meet the precision target of job *key*"""
+    fname = get_precision_record_path()
+    mkdir_p(os.path.dirname(fname))
+    lock = FileLock(os.path.join(os.path.dirname(fname), ".precision.json.lock"))
+    try: 
+        with lock.acquire(timeout = 20):
+            record = read_precision_record()
+            record[key] = frac
+            ftmp = fname + ".tmp"
+            with open(ftmp, "w") as f: 
+                json.dump(record, f, indent=1)
+            os.rename(ftmp, fname)
+    except TimeoutError: 
+        log().warn(f"Couldn't get lock on precision record: {fname}")
+
+
 #______________________________________________________________________________=buf=
 def file_hash(fname):
     """Create unique hash for file. 
@@ -877,18 +2175,63 @@ def file_hash(fname):
  
 #______________________________________________________________________________=buf=
 def load_cpp_classes():
-    """Loads LokiHist1D/2D/3D and LokiSelector c++ classes"""
-    for path in [os.path.join(get_project_path(),"src", "LokiHist.C" ),
+    """Loads LokiExpr, LokiHist1D/2D/3D, LokiEff, LokiNtup and LokiSelector c++ classes
+    
+    The classes are only loaded once per process (ACLiC can't reload 
+    them in the same process anyway). 
+    
+    If the prebuilt, optimised libLoki (see scripts/build_libloki.sh and 
+    :func:`get_libloki_path`) is available and up to date, it is loaded 
+    directly, together with its dictionary. Otherwise the classes are 
+    compiled with ACLiC. 
+    """
+    global _cpp_classes_loaded
+    if _cpp_classes_loaded: return
+    flib = get_libloki_path()
+    if flib: 
+        ROOT.gInterpreter.AddIncludePath(os.path.join(get_project_path(), "src"))
+        if ROOT.gSystem.Load(flib) >= 0: 
+            _cpp_classes_loaded = True
+            return
+        log().warn(f"Failed loading {flib}, compiling cpp classes with ACLiC")
+    for path in [os.path.join(get_project_path(),"src", "LokiExpr.C" ),
+                 os.path.join(get_project_path(),"src", "LokiHist.C" ),
                  os.path.join(get_project_path(),"src", "LokiSelector.C" )]:                 
         ROOT.gROOT.ProcessLine(f".L {path}+")
         #ROOT.gROOT.LoadMacro(f"{path}")
+    _cpp_classes_loaded = True
+
+
+#______________________________________________________________________________=buf=
+def get_libloki_path():
+    """Return path of the prebuilt libLoki (None if not built or outdated)
+    
+    If *LOKI_MARCH* is set in the environment, the corresponding ``-march`` 
+    variant is preferred (see scripts/build_libloki.sh). The library is 
+    considered outdated if any of the cpp sources is newer. 
+    """
+    build = os.path.join(get_project_path(), "build")
+    src = os.path.join(get_project_path(), "src")
+    march = os.getenv("LOKI_MARCH")
+    candidates = [os.path.join(build, "libLoki.so")]
+    if march: 
+        candidates.insert(0, os.path.join(build, f"march-{march}", "libLoki.so"))
+    tsrc = max([os.path.getmtime(os.path.join(src, f)) for f in os.listdir(src) 
+                if f.startswith(("LokiExpr.", "LokiHist.", "LokiSelector.", "LokiLinkDef."))])
+    for flib in candidates: 
+        if not os.path.exists(flib): continue
+        if os.path.getmtime(flib) < tsrc: 
+            log().warn(f"{flib} is outdated, rebuild with scripts/build_libloki.sh")
+            continue
+        return flib
+    return None
 
 
 #__________________________________________________________________________=buf=
-def get_xbins_stdvec(xbins):
-    """Return xbins in std::vector format"""
-    vec = ROOT.vector(float)()
-    for v in xbins: vec.push_back(v)
+def get_stdvec(values, vtype):
+    """Return *values* as std::vector<*vtype*>"""
+    vec = ROOT.std.vector(vtype)()
+    for v in values: vec.push_back(v)
     return vec
 
  
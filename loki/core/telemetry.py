@@ -0,0 +1,200 @@
+# encoding: utf-8
+"""
+loki.core.telemetry
+~~~~~~~~~~~~~~~~~~~
+
+Structured job telemetry for :class:`~loki.core.process.Processor` runs.
+
+Timings of the processing phases (catalogue, cache lookup, dispatch,
+processing, caching, finalize) are recorded on the driver track, while
+each selector job is recorded as a span on the track of the worker
+process that executed it. Job spans carry the number of events
+processed, the event rate, bytes read and the peak RSS of the worker,
+as well as the worker RSS at the start and end of the selector (the
+largest growth over a single selector is reported in the summary as
+``max_rss_growth_mb``). The number of column values read from the
+local column cache is summed in ``cache_reads``.
+
+The output is written in the Chrome trace event JSON format, which can
+be loaded directly in chrome://tracing or https://ui.perfetto.dev.
+A run summary (totals, cache hits, phase durations) is stored under
+the ``otherData`` key of the same file, so runs can also be compared
+programmatically.
+
+"""
+__author__    = "Will Davey"
+__email__     = "will.davey@cern.ch"
+__created__   = "2026-10-17"
+__copyright__ = "Copyright 2026 Will Davey"
+__license__   = "GPL http://www.gnu.org/licenses/gpl.html"
+
+
+## modules
+import json
+import os
+import resource
+import socket
+import time
+from contextlib import contextmanager
+from loki.core.logger import log
+
+
+# - - - - - - - - - - - class defs  - - - - - - - - - - - - #
+#------------------------------------------------------------------------------=buf=
+class Telemetry():
+    """Collects timing spans and counters for a processing run
+
+    Times are stored in microseconds since the epoch, as expected by the
+    trace viewers.
+    """
+    #__________________________________________________________________________=buf=
+    def __init__(self, name=None):
+        self.name = name or "loki"
+        self.pid = os.getpid()
+        self.events = []
+        self.phases = dict()
+        self.summary = dict()
+        self.tracks = set()
+        self.tstart = now()
+
+    #__________________________________________________________________________=buf=
+    @contextmanager
+    def phase(self, name):
+        """Context manager recording the duration of phase *name* on the driver track"""
+        ti = now()
+        try:
+            yield
+        finally:
+            self.add_span(name, ti, now() - ti, tid=self.pid, cat="phase")
+
+    #__________________________________________________________________________=buf=
+    def add_span(self, name, ts, dur, tid=None, cat=None, args=None):
+        """Add complete span (Chrome trace 'X' event)
+
+        Phase spans (*cat* = 'phase') are also accumulated in the summary.
+
+        :param name: span name
+        :type name: str
+        :param ts: start time [us]
+        :type ts: float
+        :param dur: duration [us]
+        :type dur: float
+        :param tid: track (thread) id, eg. worker pid
+        :type tid: int
+        :param cat: category
+        :type cat: str
+        :param args: additional arguments shown in viewer
+        :type args: dict
+        """
+        tid = tid or self.pid
+        self.tracks.add(tid)
+        ev = {"name": name, "ph": "X", "ts": ts, "dur": dur,
+              "pid": self.pid, "tid": tid, "cat": cat or "job"}
+        if args: ev["args"] = args
+        self.events.append(ev)
+        if cat == "phase":
+            self.phases[name] = self.phases.get(name, 0.) + dur / 1.e6
+
+    #__________________________________________________________________________=buf=
+    def add_counter(self, name, values, ts=None):
+        """Add counter sample (Chrome trace 'C' event)
+
+        :param name: counter name
+        :type name: str
+        :param values: counter values
+        :type values: dict (str, float)
+        :param ts: time [us] (default: now)
+        :type ts: float
+        """
+        self.events.append({"name": name, "ph": "C", "ts": ts or now(),
+                            "pid": self.pid, "args": values})
+
+    #__________________________________________________________________________=buf=
+    def add_job(self, stats, name=None):
+        """Add selector job span from worker *stats*
+
+        See :func:`job_stats` for the expected content.
+        """
+        args = dict(stats)
+        ts = args.pop("ts")
+        dur = args.pop("dur")
+        tid = args.pop("pid")
+        dt = dur / 1.e6
+        if dt > 0.: args["events_per_s"] = args.get("nevents", 0) / dt
+        self.add_span(name or args.get("fin", "job"), ts, dur, tid=tid, cat="job", args=args)
+        # accumulate totals
+        for k in ["nevents", "bytes_read", "nhists", "cache_reads"]:
+            self.summary[k] = self.summary.get(k, 0) + args.get(k, 0)
+        self.summary["njobs"] = self.summary.get("njobs", 0) + 1
+        self.summary["peak_rss_worker_mb"] = max(self.summary.get("peak_rss_worker_mb", 0.),
+                                                 args.get("peak_rss_mb", 0.))
+        # memory growth of the worker over a single selector (should stay flat)
+        if "rss_mb" in args: 
+            self.summary["max_rss_growth_mb"] = max(self.summary.get("max_rss_growth_mb", 0.), 
+                                                    args["rss_mb"] - args.get("rss_start_mb", 0.))
+
+    #__________________________________________________________________________=buf=
+    def set(self, **kw):
+        """Set summary values"""
+        self.summary.update(kw)
+
+    #__________________________________________________________________________=buf=
+    def write(self, fname):
+        """Write Chrome trace / Perfetto compatible JSON file"""
+        wall = (now() - self.tstart) / 1.e6
+        summary = dict(self.summary)
+        summary["wall_time_s"] = wall
+        summary["phases_s"] = dict(self.phases)
+        summary["peak_rss_driver_mb"] = peak_rss_mb()
+        if summary.get("nevents") and self.phases.get("processing"):
+            summary["events_per_s"] = summary["nevents"] / self.phases["processing"]
+        summary["host"] = socket.gethostname()
+
+        # track names
+        meta = [{"name": "process_name", "ph": "M", "pid": self.pid, "tid": self.pid,
+                 "args": {"name": self.name}}]
+        for tid in sorted(self.tracks):
+            tname = "driver" if tid == self.pid else f"worker {tid}"
+            meta.append({"name": "thread_name", "ph": "M", "pid": self.pid, "tid": tid,
+                         "args": {"name": tname}})
+
+        with open(fname, "w") as f:
+            json.dump({"traceEvents": meta + self.events,
+                       "displayTimeUnit": "ms",
+                       "otherData": summary}, f, indent=1)
+        log().info(f"Telemetry written to {fname}")
+
+
+# - - - - - - - - - - - - - - - function defs - - - - - - - - - - - - - - - - #
+#______________________________________________________________________________=buf=
+def now():
+    """Return current time in microseconds"""
+    return time.time() * 1.e6
+
+
+#______________________________________________________________________________=buf=
+def peak_rss_mb():
+    """Return peak resident set size of the current process [MB]"""
+    # ru_maxrss is in kB on linux
+    return resource.getrusage(resource.RUSAGE_SELF).ru_maxrss / 1024.
+
+
+#______________________________________________________________________________=buf=
+def job_stats(ts, nevents=0, bytes_read=0, **kw):
+    """Return dictionary of selector job statistics (measured on worker)
+
+    :param ts: job start time [us]
+    :type ts: float
+    :param nevents: number of events processed
+    :type nevents: int
+    :param bytes_read: number of bytes read from input
+    :type bytes_read: int
+    :param kw: additional stats
+    """
+    d = {"ts": ts, "dur": now() - ts, "pid": os.getpid(),
+         "nevents": nevents, "bytes_read": bytes_read, "peak_rss_mb": peak_rss_mb()}
+    d.update(kw)
+    return d
+
+
+## EOF
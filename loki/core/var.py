@@ -42,6 +42,16 @@ class VarBase(object):
     
     VarBase objects can be combined via the ``*`` operator, creating a 
     :class:`loki.core.var.Weights` object, which represents a weight string. 
+
+    Storage precision: by default float variables are written to flat 
+    ntuples as 32-bit floats. If *nbits* is given, they are stored as 
+    ``Float16_t``: as *nbits* integer over the declared *storage_range* 
+    (values outside the range are clamped), or with an *nbits* truncated 
+    mantissa if no range is given (see :func:`get_leaftype`). The values 
+    are read back as floats. Note that ROOT can't bulk read ``Float16_t`` 
+    branches, so plots made from them only use the selector's fast path 
+    with the column cache (*colcache* in :class:`~loki.core.process.Processor`), 
+    ie. trading smaller files for slower reads on a cold cache. 
     
     :param name: unique identifier
     :type name: str
@@ -59,6 +69,10 @@ class VarBase(object):
     :type truth_partner: :class:`Var`
     :param temp: if True, don't add to global variable registry
     :type temp: bool
+    :param nbits: number of bits for reduced-precision storage (2-16)
+    :type nbits: int
+    :param storage_range: value range (xmin, xmax) for reduced-precision storage
+    :type storage_range: tuple (float, float)
     """
     global_instances = dict()
     counter = 0
@@ -72,6 +86,8 @@ class VarBase(object):
             xunit   = None,
             truth_partner = None,
             temp = False,
+            nbits = None,
+            storage_range = None,
             ):      
         ## defaults 
         if xtitle is None: 
@@ -89,6 +105,8 @@ class VarBase(object):
         self.xunit         = xunit                
         self.truth_partner = truth_partner
         self.temp          = temp
+        self.nbits         = nbits
+        self.storage_range = storage_range
 
         ## members
         self.views = []        
@@ -96,6 +114,7 @@ class VarBase(object):
 
         ## initialization checks
         self.__check_invars__()
+        get_leaftype("f", nbits, storage_range)
 
         ## set unique id
         self.uid = int(VarBase.counter)
@@ -219,6 +238,16 @@ class VarBase(object):
             return self.name
         return f"{self.cont.name}.{self.name}"
 
+    #__________________________________________________________________________=buf=
+    def get_leaftype(self, typecode="f"):
+        """Return ROOT leaf type used to write the variable (eg. on tree writeout)
+        
+        :param typecode: typecode of the value array ("f" or "i")
+        :type typecode: str
+        :rtype: str
+        """
+        return get_leaftype(typecode, self.nbits, self.storage_range)
+
     #__________________________________________________________________________=buf=
     def get_view(self, name = None):
         """Return view of the variable specified by *name*. 
@@ -1123,7 +1152,7 @@ class Container(object):
 
     #__________________________________________________________________________=buf=
     def add_var(self, name, var = None, xtitle = None, xunit = None, 
-               short_title = None, truth_partner = None): 
+               short_title = None, truth_partner = None, nbits = None, storage_range = None): 
         """Adds a new simple variable to container and returns it.
         
         See :class:`loki.core.var.Var` for details.
@@ -1137,7 +1166,8 @@ class Container(object):
         
         # create var              
         v = Var(name, var=var, xtitle=xtitle, xunit=xunit, cont=self, 
-                short_title=short_title, truth_partner=truth_partner)
+                short_title=short_title, truth_partner=truth_partner, 
+                nbits=nbits, storage_range=storage_range)
         self.vars.append(v)
         
         # decorate
@@ -1147,7 +1177,7 @@ class Container(object):
 
     #__________________________________________________________________________=buf=
     def add_expr(self, name, expr = None, invars = None, xtitle = None, xunit = None, 
-               short_title = None, truth_partner = None): 
+               short_title = None, truth_partner = None, nbits = None, storage_range = None): 
         """Adds complex and/or multi-variable expression to container and returns it.
         
         See :class:`loki.core.var.Expr` for details. 
@@ -1161,7 +1191,8 @@ class Container(object):
             
         # create expression    
         v = Expr(name, expr=expr, invars=invars, xtitle=xtitle, xunit=xunit, 
-                 cont=self, short_title=short_title, truth_partner=truth_partner)
+                 cont=self, short_title=short_title, truth_partner=truth_partner, 
+                 nbits=nbits, storage_range=storage_range)
         self.vars.append(v)
         
         # decorate
@@ -1461,6 +1492,36 @@ def get_view(view_str):
     return view        
         
         
+#______________________________________________________________________________=buf=
+def get_leaftype(typecode, nbits=None, storage_range=None):
+    """Return ROOT leaf type for writing values of array *typecode* 
+    
+    Integers ("i") are written as is. Floats ("f") are written as ``Float_t`` 
+    ("F") unless *nbits* is given, in which case they are written as 
+    ``Float16_t``: "f[xmin,xmax,nbits]" over the *storage_range* (xmin, xmax), 
+    or "f[0,0,nbits]" (truncated mantissa) if no range is given. 
+    ``Float16_t`` branches can't be bulk read (see :class:`VarBase`). 
+    
+    :param typecode: array typecode
+    :type typecode: str
+    :param nbits: number of bits (2-16)
+    :type nbits: int
+    :param storage_range: value range (xmin, xmax)
+    :type storage_range: tuple (float, float)
+    :rtype: str
+    """
+    if nbits is not None and not 2 <= nbits <= 16: 
+        log().error(f"Invalid storage precision nbits={nbits} (must be 2-16)")
+        raise VarError
+    if storage_range is not None and (nbits is None or storage_range[0] >= storage_range[1]): 
+        log().error(f"Invalid storage range {storage_range} (requires nbits and xmin < xmax)")
+        raise VarError
+    if typecode != "f" or not nbits: 
+        return typecode.capitalize()
+    (xmin, xmax) = storage_range or (0, 0)
+    return f"f[{xmin},{xmax},{nbits}]"
+
+
 #____________________________________________________________
 def default_weight():
     """Return default weight"""
@@ -4,7 +4,11 @@
     :members:
 .. automodule:: loki.train.algs
     :members:
+.. automodule:: loki.train.dataset
+    :members:
 .. automodule:: loki.train.ntup
     :members:
+.. automodule:: loki.train.scheduler
+    :members:
 
 """
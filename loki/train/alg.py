@@ -26,7 +26,6 @@ import os, sys, shutil, time, itertools, json, logging, tempfile
 from glob import glob
 from array import array
 from copy import copy
-from multiprocessing import Pool, cpu_count
 import subprocess
 
 # - - - - - - - - - - - - - - -  class defs - - - - - - - - - - - - - - - - - #
@@ -70,6 +69,8 @@ class AlgBase(object):
     # 'static' variables
     fname_json = "config.json"
     dname_aux = "aux"    
+    mem_base = 500.    # baseline memory footprint of a training job [MB]
+    mem_per_mb = 3.0   # memory per MB of (compressed) input data
     #__________________________________________________________________________=buf=
     def __init__(self, name = None, wspath = None, valtype = None, info = None):
         # general defaults
@@ -92,6 +93,8 @@ class AlgBase(object):
         self.tmpdir = None
         self.logout = None
         self.logerr = None
+        self.nthreads = None
+        self.shared_data = False
 
         if wspath and not self.ispersistified():
             log().warn("Passing 'wspath' to alg constructor does not persistify, use alg.saveas(wspath)") 
@@ -125,6 +128,42 @@ class AlgBase(object):
         """
         return self.name
 
+    #__________________________________________________________________________=buf=
+    def get_resources(self):
+        """Return (nthreads, memory [MB]) required for training (can override in subclass)
+        
+        Used by :func:`train_local` to pack jobs onto the local machine. 
+        The default is a single-threaded job whose memory scales with the 
+        size of the input samples. 
+        """
+        return (1, self.__get_mem_estimate__())
+
+    #__________________________________________________________________________=buf=
+    def get_data_key(self):
+        """Return key identifying the training inputs (sample files, selections, weights and input vars)
+        
+        Algs with the same key (eg. grid points spawned from the same template)
+        are trained on identical data. The key is built with 
+        :func:`~loki.train.dataset.dataset_key` (same rules as the shared 
+        datasets) over all samples of the alg, in attribute order. 
+        """
+        from loki.train.dataset import dataset_key
+        (config, samples, info) = self.__get_attr_groups__()
+        samples = [samples[k] for k in sorted(samples.keys()) if samples[k]]
+        samples = [self.__get_sample_worker__(s) if s.files else s for s in samples]
+        return dataset_key(samples, getattr(self, "invars", None) or [])
+
+    #__________________________________________________________________________=buf=
+    def get_shared_datasets(self):
+        """Return list of :class:`~loki.train.dataset.SharedDataset` used in training 
+        (override in subclasses supporting shared training data)
+        
+        If the alg is trained with *shared_data* enabled (set by :func:`train_local` 
+        when several algs are trained on the same inputs), the training data 
+        is built once and attached by all algs via these datasets. 
+        """
+        return []
+
     #__________________________________________________________________________=buf=
     def ispersistified(self):
         """Return True if alg is persistified"""    
@@ -390,6 +429,17 @@ class AlgBase(object):
         snew.files =  [self.__get_abspath_worker__(f) for f in s.files]
         return snew
 
+    #__________________________________________________________________________=buf=
+    def __get_mem_estimate__(self):
+        """Return memory estimate [MB] based on the size of the input samples"""
+        (config, samples, info) = self.__get_attr_groups__()
+        nbytes = 0
+        for s in samples.values():
+            for f in s.files or []:
+                fpath = self.__get_abspath_worker__(f)
+                if os.path.exists(fpath): nbytes += os.path.getsize(fpath)
+        return self.mem_base + self.mem_per_mb * nbytes / 1024.**2
+
     #__________________________________________________________________________=buf=
     def __get_fmodel_path__(self):
         """Return path to the model file"""
@@ -413,15 +463,20 @@ class AlgBase(object):
         return auxdir
 
     #__________________________________________________________________________=buf=
-    def __finalize_training_outputs__(self, fmodel_old, aux_files):
-        """Move temp training outputs to final paths"""
+    def __finalize_training_outputs__(self, fmodel_old, aux_files, fmodel_new=None):
+        """Move temp training outputs to final paths
+        
+        The model is stored as 'model' (with the extension of *fmodel_old*), 
+        unless another name is given by *fmodel_new*. 
+        """
         # model
         if fmodel_old:    
             if not os.path.exists(fmodel_old):
                 log().warn("Failure writing model, output not found: {0}".format(fmodel_old))
             else:
                 (_, fext) = os.path.splitext(fmodel_old)        
-                fmodel_new = "model" + fext if fext else "model"
+                if not fmodel_new: 
+                    fmodel_new = "model" + fext if fext else "model"
                 fmodel_new_path = os.path.join(self.wspath, fmodel_new)
                 if os.path.exists(fmodel_new_path): 
                     log().info("Removing existing model file: {}".format(fmodel_new_path))
@@ -581,17 +636,24 @@ def load(wspath):
 
 
 #______________________________________________________________________________=buf=
-def train_local(algs, retrain=False, ncores=None):
+def train_local(algs, retrain=False, ncores=None, memory=None):
     """Train a list of algorithms on local machine
     
     Previously trained algorithms will be skipped unless *retrain* is set to True. 
     
+    Multiple algorithms are trained in parallel using the 
+    :class:`~loki.train.scheduler.LocalScheduler`, which packs the jobs 
+    onto the available cores and memory according to the resource demands 
+    of each alg (see :func:`AlgBase.get_resources`). 
+    
     :param algs: algorithms to train
     :type algs: list :class:`AlgBase`
     :param retrain: force retrain on previously trained algorithms
     :type retrain: bool
     :param ncores: number of cores to use
     :type ncores: int
+    :param memory: memory to use [MB] (default: 90% of physical memory)
+    :type memory: float
     """
     if not isinstance(algs,list): algs = [algs]
     # multiple algs
@@ -608,30 +670,27 @@ def train_local(algs, retrain=False, ncores=None):
             log().info("No algs to process")
             return True
         
-        # determine number of cores
-        if not ncores:   ncores = cpu_count()
-        elif ncores < 0: ncores = max(1, cpu_count() + ncores)
-        else:            ncores = min(ncores, cpu_count())
+        # share training data between algs on the same inputs
+        keys = [a.get_data_key() for a in algs_submit]
+        shared = [keys.count(k) > 1 and bool(a.get_shared_datasets()) 
+                  for (a, k) in zip(algs_submit, keys)]
         
-        # create pool and unleash the fury
+        # schedule jobs according to resource demands
+        from loki.train.scheduler import LocalScheduler, Job
         log().info("Processing {} algs in local mode".format(len(algs_submit)))
-        log().info("Lighting up {} cores".format(ncores))        
-        pool = Pool(processes=ncores)
-        results = [pool.apply_async(run_train, (a.wspath,)) for a in algs_submit]
-        
-        # monitory progress
-        failures = 0
-        while results: 
-            for r in results:
-                if r.ready():
-                    status = r.get()
-                    results.remove(r)
-                    if not status:
-                        failures += 1
-                        log().error("Training Job Failed! {} left".format(len(results)))
-                    else: 
-                        log().info("Job finished! {} left".format(len(results)))                        
-            time.sleep(2)
+        scheduler = LocalScheduler(ncores=ncores, memory=memory)
+        for (a, k, sh) in zip(algs_submit, keys, shared): 
+            (nthreads, mem) = a.get_resources()
+            scheduler.add(Job(run_train, (a.wspath, sh), nthreads=nthreads, mem=mem, 
+                              key=k, name=os.path.relpath(a.wspath)))
+        
+        # unleash the fury
+        failures = scheduler.run()
+        
+        # clean up shared training data
+        for (a, sh) in zip(algs_submit, shared): 
+            if not sh: continue
+            for d in a.get_shared_datasets(): d.remove()
         
         if failures:
             log().warn("Training completed with {} failures".format(failures))
@@ -797,13 +856,23 @@ def spawn_grid(alg, attrname, dirname=None):
 
 
 #______________________________________________________________________________=buf=
-def run_train(wspath):
-    """Run alg train on multiprocess thread"""
+def run_train(wspath, shared_data=False, nthreads=None):
+    """Run alg train on multiprocess thread
+    
+    :param wspath: workspace path
+    :type wspath: str
+    :param shared_data: attach to shared training data (see :mod:`loki.train.dataset`)
+    :type shared_data: bool
+    :param nthreads: number of threads allocated to the job
+    :type nthreads: int
+    """
     f = open(os.path.join(wspath,"train.log"),'w')
     sys.stdout = sys.stderr = f
     os.dup2(f.fileno(), 1)
     os.dup2(f.fileno(), 2)
     alg = load(wspath)
+    alg.nthreads = nthreads
+    alg.shared_data = shared_data
     status = alg.train()
     sys.stdout = sys.__stdout__
     sys.stderr = sys.__stderr__
@@ -18,11 +18,13 @@ import os
 import pkgutil
 import random
 from array import array
+import numpy as np
 from ROOT import TFile, TCut, TMVA, TH2, TGraph, TGraph2D, TNamed, TParameter
 
 from loki.common import vars
 from loki.core.hist import RootDrawable, Hist
 from loki.core.histutils import normalize, convert_hist_to_2dhist, frange
+from loki.core.histutils import bin_contents, bin_sumw2, bin_edges, bin_centers
 from loki.core.logger import log
 from loki.core.sample import Sample
 from loki.core.var import get_variable, get_variables, find_view, get_view
@@ -518,6 +520,7 @@ class XGBClassifier(AlgBase):
     * *algopts['num_boost_round']* - is a particularly important option for XGBoost. 
       It specifies the number of iterations of additional boosting to be performed.
     * *algopts['early_stopping_rounds']* - if specified, testing data must be provided. 
+    * *algopts['nthread']* - number of threads requested from the local scheduler (default: 4). 
 
     *wspath* and *info* are not to be set by the user (see :class:`~loki.train.alg.AlgBase`)  
     
@@ -537,6 +540,7 @@ class XGBClassifier(AlgBase):
     :type bkg_test: :class:`~loki.core.sample.Sample`
     :param kw: key-word args passed to :class:`~loki.train.alg.AlgBase`    
     """
+    default_nthreads = 4
     #__________________________________________________________________________=buf=
     def __init__(self, name=None, wspath = None, info = None, 
                  algopts = None, invars = None,
@@ -572,6 +576,31 @@ class XGBClassifier(AlgBase):
         # members
         self.cname = "classifier"
 
+    #__________________________________________________________________________=buf=
+    def get_resources(self):
+        """Return (nthreads, memory [MB]) required for training
+        
+        The thread demand is taken from *algopts['nthread']* (default: 4).
+        The memory estimate accounts for the feature matrix of the training 
+        and testing data, which scales with the number of input variables. 
+        """
+        nthreads = int(self.algopts.get("nthread", None) or self.default_nthreads)
+        mem = self.__get_mem_estimate__() * max(1., len(self.invars) / 10.)
+        return (nthreads, mem)
+
+    #__________________________________________________________________________=buf=
+    def get_shared_datasets(self):
+        """Return shared training (and testing) datasets"""
+        from loki.train.dataset import SharedDataset
+        sig_train = self.__get_sample_worker__(self.sig_train)
+        bkg_train = self.__get_sample_worker__(self.bkg_train)
+        datasets = [SharedDataset(sig_train, bkg_train, self.invars)]
+        if self.sig_test.files and self.bkg_test.files: 
+            sig_test = self.__get_sample_worker__(self.sig_test)
+            bkg_test = self.__get_sample_worker__(self.bkg_test)
+            datasets.append(SharedDataset(sig_test, bkg_test, self.invars))
+        return datasets
+
     #__________________________________________________________________________=buf=
     def __subclass_train__(self):
         """Train the classifier"""
@@ -580,6 +609,7 @@ class XGBClassifier(AlgBase):
         algopts         = dict(self.algopts)
         num_boost_round = algopts.pop("num_boost_round", None)
         early_stopping_rounds = algopts.pop("early_stopping_rounds", None)
+        if self.nthreads: algopts["nthread"] = self.nthreads
 
         # pre-train checks
         if not self.ispersistified(): 
@@ -606,9 +636,14 @@ class XGBClassifier(AlgBase):
 
         # format trees into arrays
         log().info("Preparing input data...")
-        dtrain = samples2dmatrix(sig_train, bkg_train, self.invars)
+        if self.shared_data: 
+            datasets = self.get_shared_datasets()
+            dtrain = datasets[0].get_dmatrix()
+        else: 
+            dtrain = samples2dmatrix(sig_train, bkg_train, self.invars)
         if sig_test and bkg_test:
-            dtest = samples2dmatrix(sig_test, bkg_test, self.invars)
+            if self.shared_data: dtest = datasets[1].get_dmatrix()
+            else:                dtest = samples2dmatrix(sig_test, bkg_test, self.invars)
             watchlist = [(dtrain, "train"), (dtest, "test")]
         else:
             watchlist = [(dtrain, "train")]
@@ -725,6 +760,16 @@ class MVScoreTuner(AlgBase):
     If the cut should be applied in reverse (ie. cut < disc), set 
     *reverse=True*.  
     
+    Multiple targets: several discriminants and/or selections (eg. 1-prong 
+    and 3-prong) can be tuned together by passing a list of *targets*, 
+    each a dict with keys 'tag', 'disc' (default: *disc*) and 'sel' 
+    (default: none). The working point hists of all targets are filled in 
+    a single pass over the input, and a separate model file is written 
+    per target (model_<tag>.root). Pass *target* (the tag) to the predict 
+    method to select the model. 
+    
+    The input is processed with the parallel :class:`~loki.core.process.Processor`, 
+    splitting the input file into one shard per allocated thread. 
 
     Working point prediction: 
 
@@ -757,12 +802,16 @@ class MVScoreTuner(AlgBase):
     :type yvals2d: tuple (float, float)
     :param sig_train: signal training sample
     :type sig_train: :class:`~loki.core.sample.Sample`
+    :param targets: list of tuning targets (dicts with keys 'tag', 'disc', 'sel')
+    :type targets: list dict
     :param kw: key-word args passed to :class:`~loki.train.alg.AlgBase`    
     """
+    default_nthreads = 4
     #__________________________________________________________________________=buf=
     def __init__(self, name=None, wspath = None, info = None, 
                  sig_train = None, disc = None, xvar = None, yvar = None, 
-                 reverse = None, smooth = None, usehist = None, yvals2d = None):    
+                 reverse = None, smooth = None, usehist = None, yvals2d = None, 
+                 targets = None):    
         if name is None: name = "MVScoreTuner"
         AlgBase.__init__(self, name=name, wspath=wspath, info=info, valtype='f')
         
@@ -775,6 +824,10 @@ class MVScoreTuner(AlgBase):
         xvar = get_view(xvar)
         if yvar: yvar = get_view(yvar)
         if reverse is None: reverse = False
+        if targets: 
+            targets = [{"tag": str(t["tag"]), 
+                        "disc": get_view(t.get("disc") or disc), 
+                        "sel": get_variable(t.get("sel"))} for t in targets]
 
         # set attributes
         self.sig_train = sig_train
@@ -785,7 +838,16 @@ class MVScoreTuner(AlgBase):
         self.smooth = smooth
         self.usehist = usehist
         self.yvals2d = yvals2d        
+        self.targets = targets
         
+    #__________________________________________________________________________=buf=
+    def get_resources(self):
+        """Return (nthreads, memory [MB]) required for training
+        
+        The working point hists are filled in parallel (default: 4 threads).
+        """
+        return (self.default_nthreads, self.__get_mem_estimate__())
+
     # Subclass overrides
     #__________________________________________________________________________=buf=
     def __subclass_train__(self):
@@ -816,35 +878,54 @@ class MVScoreTuner(AlgBase):
         s = self.__get_sample_worker__(self.sig_train)
         if not self.__check_sample__(s): return False
 
-        # define working point extractor
-        wpe = WorkingPointExtractor(s, disc=disc, xvar=xvar, yvar=yvar, 
-              reverse=reverse, smooth1D=smooth1D, smooth2D=smooth2D)
+        # define working point extractors (one per target)
+        targets = self.targets or [{"tag": None, "disc": disc, "sel": None}]
+        wpes = [WorkingPointExtractor(s, disc=t["disc"], xvar=xvar, yvar=yvar, sel=t["sel"],
+                reverse=reverse, smooth1D=smooth1D, smooth2D=smooth2D) for t in targets]
 
-        # process
+        # process (all targets in one pass)
         from loki.core.process import Processor
-        p = Processor(ncores=1)
-        p.process(wpe)
+        from loki.train.scheduler import get_ncores
+        ncores = get_ncores(self.nthreads)
+        p = Processor(ncores=ncores, nshards=ncores)
+        p.process(wpes)
         p.draw_plots()
     
         from loki.core.file import OutputFileStream 
-        ofstream = OutputFileStream(fname_model)
-        ofstream.write(wpe)
-        ofstream.f.Close()
+        fmodels = dict()
+        for (t, wpe) in zip(targets, wpes): 
+            fname = f"model_{t['tag']}.root" if t["tag"] else fname_model
+            ofstream = OutputFileStream(fname)
+            ofstream.write(wpe)
+            ofstream.f.Close()
         
-        ## move outputs to workspace
-        self.__finalize_training_outputs__(fname_model, None)
+            ## move outputs to workspace
+            self.__finalize_training_outputs__(fname, None, fmodel_new=fname)
+            if t["tag"]: fmodels[t["tag"]] = self.info["fmodel"]
+        if fmodels: 
+            self.info["fmodels"] = fmodels
+            self.info["fmodel"] = fmodels[targets[0]["tag"]]
 
         return True
 
     #__________________________________________________________________________=buf=
-    def __subclass_predict__(self, s, eff=None):
+    def __subclass_predict__(self, s, eff=None, target=None):
         """Sub-class specific prediction implementation
                 
         :param eff: working point efficiency in percentage 
         :type eff: int
+        :param target: tag of the tuning target (default: first target)
+        :type target: str
         """
         fmodel = self.__get_fmodel_path__()
         disc = self.disc.var
+        if self.targets: 
+            t = [t for t in self.targets if t["tag"] == target] if target else self.targets[:1]
+            if not t: 
+                log().error(f"Unknown target {target}, cannot predict")
+                return None
+            disc = t[0]["disc"].var
+            fmodel = os.path.join(self.wspath, self.info["fmodels"][t[0]["tag"]])
         xvar = self.xvar.var
         yvar = self.yvar.var if self.yvar else None
         usehist = self.usehist
@@ -929,13 +1010,16 @@ class MVScoreTuner(AlgBase):
         return self.__predict_python_loop__(inputs)
 
     #__________________________________________________________________________=buf=
-    def get_var_name(self, eff=None):
+    def get_var_name(self, eff=None, target=None):
         """Return unique var naem based on kw args passed to the predict method
         
         :param eff: working point efficiency in percentage 
         :type eff: int
+        :param target: tag of the tuning target
+        :type target: str
         """
         name = str(self.name)
+        if target: name += str(target)
         if eff is None:
             name += "Score"
         else:
@@ -1250,7 +1334,7 @@ class WorkingPointExtractor(RootDrawable):
         w.r.t truth) *h_total* can be specified, which is a 1D histogram 
         in the dependent variable.
           
-        Uses :func:`__find_score_cut__`
+        Uses :func:`__scan_cuts__`
         
         :param h: 2D hist of discriminant vs dependent variable
         :type h: :class:`ROOT.TH2`
@@ -1260,22 +1344,53 @@ class WorkingPointExtractor(RootDrawable):
         :type h_total: :class:`ROOT.TH1`
         :rtype: list of tuple (float, float)
         """
-        min_cut = h.GetYaxis().GetBinLowEdge(1)
+        ntot = bin_contents(h_total) if h_total else None
+        return self.__scan_cuts__(bin_contents(h), ntot, h.GetXaxis(), h.GetYaxis(), target_eff)
+
+    #__________________________________________________________________________=buf=
+    def __scan_cuts__(self, c, ntot, xaxis, daxis, target_eff):
+        """Returns a list of tuples (*x*, *cut*), see :func:`__get_cuts__`
+        
+        Works on the bin contents (numpy views), so the projections of 
+        the discriminant in each bin of the dependent variable are 
+        simply rows of *c*. 
+        
+        Uses :func:`__find_score_cut__`
+        
+        :param c: bin contents of discriminant vs dependent variable (nx+2, nd+2)
+        :type c: :class:`numpy.ndarray`
+        :param ntot: bin contents of dependent variable before selection (nx+2)
+        :type ntot: :class:`numpy.ndarray`
+        :param xaxis: dependent variable axis
+        :type xaxis: :class:`ROOT.TAxis`
+        :param daxis: discriminant axis
+        :type daxis: :class:`ROOT.TAxis`
+        :param target_eff: target efficiency
+        :type target_eff: float
+        :rtype: list of tuple (float, float)
+        """
+        # discriminant bin low edges (including underflow/overflow)
+        edges = bin_edges(daxis)
+        width = (edges[-1] - edges[0]) / daxis.GetNbins()
+        edges = np.concatenate([[edges[0] - width], edges, [edges[-1] + width]])
+        min_cut = edges[1]
+        
+        xedges = bin_edges(xaxis)
+        xcenters = bin_centers(xaxis)
         cuts = []
-        for i_bin in range(1,h.GetNbinsX()+1): 
-            h_proj = h.ProjectionY("_py", i_bin,i_bin)
+        for i_bin in range(1,xaxis.GetNbins()+1): 
+            h_proj = np.array(c[i_bin], dtype=np.float64)
             # normalise
-            if h_total: 
-                ntot = h_total.GetBinContent(i_bin)
-                if ntot: h_proj.Scale(1./ntot)
+            if ntot is not None: 
+                if ntot[i_bin]: h_proj /= ntot[i_bin]
             else: 
-                normalize(h_proj)    
-            cut = self.__find_score_cut__(h_proj,target_eff)
+                n = h_proj.sum()
+                if n: h_proj /= n
+            cut = self.__find_score_cut__(h_proj,edges,target_eff)
             
             ## throw error if efficiency not reached
             if cut is False:
-                xmin = h.GetXaxis().GetBinLowEdge(i_bin)
-                xmax = h.GetXaxis().GetBinLowEdge(i_bin+1)
+                (xmin, xmax) = (xedges[i_bin-1], xedges[i_bin])
                 # use previous cut
                 if len(cuts): 
                     cut = cuts[-1][1]
@@ -1285,18 +1400,19 @@ class WorkingPointExtractor(RootDrawable):
                 log().warn(f"Failed to reach target eff: {target_eff:.3f} for x-bin ({xmin},{xmax}), using cut: {cut}")
                 #raise ValueError(f"Failed to reach target eff:{target_eff:.3f} for x-bin ({xmin},{xmax})!") 
                 
-            var = h.GetXaxis().GetBinCenter(i_bin)
-            cuts.append([var,cut])
+            cuts.append([xcenters[i_bin-1],cut])
         return cuts
 
     #__________________________________________________________________________=buf=    
-    def __find_score_cut__(self, h, target_eff):
+    def __find_score_cut__(self, h, edges, target_eff):
         """Return discriminant score cut for target efficiency                 
         
         If target not reached 'False' is returned. 
         
-        :param h: (normalized) 1D hist of discriminant
-        :type h: :class:`ROOT.TH1`
+        :param h: (normalized) bin contents of discriminant (including underflow/overflow)
+        :type h: :class:`numpy.ndarray`
+        :param edges: bin low edges of discriminant (including underflow/overflow)
+        :type edges: :class:`numpy.ndarray`
         :param target_eff: target efficiency
         :type target_eff: float
         :rtype: float
@@ -1304,25 +1420,20 @@ class WorkingPointExtractor(RootDrawable):
         """
         # Code gets error-prone if the overflow bin contains enough events
         # to satisfy target efficiency.
-        last_bin = h.GetNbinsX()+1
-        if h.GetBinContent(last_bin) > target_eff:
+        last_bin = len(h)-1
+        if h[last_bin] > target_eff:
             return False
             #raise ValueError("Overflow bin is too full")
-        # Iterate over all bins.
-        # Stop when we've met target efficiency.
-        integral = 0.0
+        # Cumulative efficiency for a cut at each bin, take the 
+        # first (loosest) cut meeting the target efficiency. 
+        # Restrict precision in comparison to avoid floating point problems on 100%
+        target = round(target_eff, 3)
         if self.reverse: 
-            for i_bin in range(last_bin+1):
-                integral += h.GetBinContent(i_bin)
-                # restrict precision in comparison to avoid floating point problems on 100%
-                if float(f"{integral:.3f}")>=float(f"{target_eff:.3f}"):
-                    return h.GetBinLowEdge(i_bin+1)            
+            passed = np.flatnonzero(np.round(np.cumsum(h), 3) >= target)
+            if len(passed): return float(edges[passed[0]+1])
         else: 
-            for i_bin in reversed(range(last_bin+1)):
-                integral += h.GetBinContent(i_bin)
-                # restrict precision in comparison to avoid floating point problems on 100%
-                if float(f"{integral:.3f}")>=float(f"{target_eff:.3f}"):
-                    return h.GetBinLowEdge(i_bin)
+            passed = np.flatnonzero(np.round(np.cumsum(h[::-1])[::-1], 3) >= target)
+            if len(passed): return float(edges[passed[-1]])
         
         return False
         #raise ValueError("Not all target efficiencies reached")
@@ -1340,9 +1451,9 @@ class WorkingPointExtractor(RootDrawable):
         cuts = self.__get_cuts__(h,target_eff,h_total)
         hnew = h.ProjectionX(hname)
         hnew.Reset()
-        for i in range(len(cuts)): 
-            hnew.SetBinContent(i+1, cuts[i][1])
-            hnew.SetBinError(i+1,0)
+        bin_contents(hnew)[1:-1] = [cut for (x, cut) in cuts]
+        sumw2 = bin_sumw2(hnew)
+        if sumw2 is not None: sumw2[:] = 0.
         return hnew
 
     #__________________________________________________________________________=buf=
@@ -1362,19 +1473,15 @@ class WorkingPointExtractor(RootDrawable):
         hnew.SetName(hname)
         #print "bins x: ", hnew.GetNbinsX(), ", binsy: ", hnew.GetNbinsY()
         
-        # loop over y-bins and project xz
+        # loop over y-bins and scan xz slices of the bin contents 
+        c = bin_contents(h)
+        ntot = bin_contents(h_total) if h_total else None
+        cnew = bin_contents(hnew)
         for iy in range(1, h.GetNbinsY()+1):
-            log().debug(f"Projecting y-bin {iy:d}: [{h.GetYaxis().GetBinLowEdge(iy):f}, {h.GetYaxis().GetBinLowEdge(iy+1):f}]")
-            h.GetYaxis().SetRange(iy,iy)
-            htemp = h.Project3D("zx")
-            h.GetYaxis().SetRange() #reset range
-            if h_total: 
-                pname = f"{h_total.GetName()}_x{iy:d}"
-                htemp_total = h_total.ProjectionX(pname, iy, iy)
-            else: htemp_total = None
-            cuts = self.__get_cuts__(htemp,target_eff,htemp_total)
-            for ix in range(1, h.GetNbinsX()+1): 
-                hnew.SetBinContent(ix, iy, cuts[ix-1][1])
+            log().debug(f"Scanning y-bin {iy:d}: [{h.GetYaxis().GetBinLowEdge(iy):f}, {h.GetYaxis().GetBinLowEdge(iy+1):f}]")
+            ntot_y = ntot[:,iy] if ntot is not None else None
+            cuts = self.__scan_cuts__(c[:,iy,:], ntot_y, h.GetXaxis(), h.GetZaxis(), target_eff)
+            cnew[1:-1,iy] = [cut for (x, cut) in cuts]
             
         return hnew
 
@@ -1499,7 +1606,9 @@ class Reweighter(AlgBase):
         h_ref = Hist(sample=ref, xvar=var, name = "h_ref")
         g_ratio = Ratio(h_ref,h_tar,owner=True, name="g_ratio")
         from loki.core.process import Processor
-        p = Processor(ncores=1)
+        from loki.train.scheduler import get_ncores
+        ncores = get_ncores(self.nthreads)
+        p = Processor(ncores=ncores, nshards=ncores)
         p.process(g_ratio)
         self.g = g_ratio.rootobj()
     
@@ -0,0 +1,184 @@
+# encoding: utf-8
+"""
+loki.train.dataset.py
+~~~~~~~~~~~~~~~~~~~~~
+
+Shared, memory-mapped training datasets.
+
+Grid scans spawned via :func:`~loki.train.alg.spawn_grid` train many
+algorithms on identical inputs. Rather than having every grid point
+re-read and re-decode the input ntuples, the first job to request a
+given dataset builds the feature matrix, labels and weights once and
+writes them as raw ``.npy`` arrays into a shared-memory directory
+(``/dev/shm`` if available). All later jobs attach to the same arrays
+via read-only memory maps, so the data preparation is paid once per
+scan rather than once per grid point.
+
+Datasets are keyed by the input sample files (path, size and
+modification time), the sample weights and the input variables.
+
+"""
+__author__    = "Will Davey"
+__email__     = "will.davey@cern.ch"
+__created__   = "2026-10-17"
+__copyright__ = "Copyright 2026 Will Davey"
+__license__   = "GPL http://www.gnu.org/licenses/gpl.html"
+
+
+## modules
+import glob
+import hashlib
+import os
+import tempfile
+from loki.core.filelock import FileLock
+from loki.core.logger import log
+
+
+# - - - - - - - - - - - - - - -  class defs - - - - - - - - - - - - - - - - - #
+#------------------------------------------------------------------------------=buf=
+class SharedDataset(object):
+    """Signal+background training data stored in shared memory-mapped arrays
+
+    The arrays are built on first access by the first process (guarded
+    by a file lock) and attached read-only by all others.
+
+    :param sig: signal sample
+    :type sig: :class:`~loki.core.sample.Sample`
+    :param bkg: background sample
+    :type bkg: :class:`~loki.core.sample.Sample`
+    :param invars: input variables
+    :type invars: list :class:`~loki.core.var.VarBase` subclass
+    :param cachedir: directory for the shared arrays (default: :func:`get_cachedir`)
+    :type cachedir: str
+    """
+    components = ["data", "label", "weight"]
+    #__________________________________________________________________________=buf=
+    def __init__(self, sig, bkg, invars, cachedir=None):
+        self.sig = sig
+        self.bkg = bkg
+        self.invars = invars
+        self.cachedir = cachedir or get_cachedir()
+        self.key = dataset_key([sig, bkg], invars)
+
+    #__________________________________________________________________________=buf=
+    def get_path(self, component):
+        """Return path to array file for *component* (data, label or weight)"""
+        return os.path.join(self.cachedir, f"{self.key}_{component}.npy")
+
+    #__________________________________________________________________________=buf=
+    def exists(self):
+        """Return True if all arrays are available"""
+        return all([os.path.exists(self.get_path(c)) for c in self.components])
+
+    #__________________________________________________________________________=buf=
+    def get_arrays(self):
+        """Return (data, label, weight) as read-only memory-mapped arrays"""
+        import numpy
+        if not self.exists():
+            lock = FileLock(os.path.join(self.cachedir, f".{self.key}.lock"))
+            with lock.acquire():
+                if not self.exists(): self.__build__()
+        else:
+            log().info(f"Attaching to shared dataset {self.key}")
+        return tuple([numpy.load(self.get_path(c), mmap_mode="r") for c in self.components])
+
+    #__________________________________________________________________________=buf=
+    def get_dmatrix(self):
+        """Return xgboost DMatrix built from the shared arrays"""
+        import xgboost
+        (data, label, weight) = self.get_arrays()
+        return xgboost.DMatrix(data, label=label, weight=weight)
+
+    #__________________________________________________________________________=buf=
+    def remove(self):
+        """Remove the shared arrays"""
+        remove_datasets([self.key], cachedir=self.cachedir)
+
+    #__________________________________________________________________________=buf=
+    def __build__(self):
+        """Build arrays from the input samples and write to the shared dir
+
+        The arrays are written to temporary files and moved into place,
+        so that concurrent readers never see partially written data.
+        """
+        import numpy
+        from loki.core.process import samples2arrays
+        log().info(f"Building shared dataset {self.key} in {self.cachedir}")
+        arrays = samples2arrays(self.sig, self.bkg, list(self.invars))
+        for (c, a) in zip(self.components, arrays):
+            (fd, ftmp) = tempfile.mkstemp(suffix=".npy", dir=self.cachedir)
+            with os.fdopen(fd, "wb") as f:
+                numpy.save(f, numpy.ascontiguousarray(a))
+            os.rename(ftmp, self.get_path(c))
+
+
+# - - - - - - - - - - - - - - - function defs - - - - - - - - - - - - - - - - #
+#______________________________________________________________________________=buf=
+def get_cachedir():
+    """Return directory for shared datasets (created if needed)
+
+    Can be set via the LOKI_SHM_DIR environment variable, otherwise
+    uses ``/dev/shm`` if available, falling back to the tmp dir.
+    """
+    cachedir = os.getenv("LOKI_SHM_DIR")
+    if not cachedir:
+        base = "/dev/shm" if os.path.isdir("/dev/shm") else tempfile.gettempdir()
+        cachedir = os.path.join(base, f"loki-{os.getuid()}")
+    if not os.path.exists(cachedir):
+        from loki.core.helpers import mkdir_p
+        mkdir_p(cachedir)
+    return cachedir
+
+
+#______________________________________________________________________________=buf=
+def dataset_key(samples, invars):
+    """Return unique key for dataset built from *samples* and *invars*
+    
+    The key covers the input files (path, size and modification time), 
+    the selection and weight expressions of each sample (as applied by 
+    :meth:`~loki.core.sample.Sample.get_ndarray`) and the input vars. 
+    """
+    hash_obj = hashlib.md5()
+    for s in samples:
+        for f in s.files or []:
+            fpath = os.path.abspath(f)
+            hash_obj.update(fpath.encode())
+            if os.path.exists(fpath):
+                hash_obj.update(f"{os.path.getsize(fpath)}:{os.path.getmtime(fpath)}".encode())
+        hash_obj.update(str(sample_expr(s, s.sel)).encode())
+        hash_obj.update("|".encode())
+        hash_obj.update(str(sample_expr(s, s.weight)).encode())
+        hash_obj.update("|".encode())
+    for v in invars:
+        hash_obj.update(v.get_name().encode())
+        hash_obj.update("|".encode())
+    return hash_obj.hexdigest()
+
+
+#______________________________________________________________________________=buf=
+def sample_expr(sample, var):
+    """Return expression of *var* (eg. selection or weight) on the tree of *sample*
+    
+    Falls back to the var name if the sample has no input files. 
+    Returns None if *var* is not defined. 
+    """
+    if var is None: return None
+    t = sample.get_tree(sample.files[0]) if sample.files else None
+    if not t: return var.get_name()
+    var.tree_init(t)
+    return var.get_expr()
+
+
+#______________________________________________________________________________=buf=
+def remove_datasets(keys, cachedir=None):
+    """Remove shared datasets with *keys*"""
+    cachedir = cachedir or get_cachedir()
+    for key in keys:
+        for fname in glob.glob(os.path.join(cachedir, f"{key}_*.npy")):
+            log().debug(f"Removing shared dataset file {fname}")
+            os.remove(fname)
+        flock = os.path.join(cachedir, f".{key}.lock")
+        if os.path.exists(flock): os.remove(flock)
+
+
+## EOF
@@ -5,6 +5,11 @@ loki.train.ntup.py
 
 Utils for creating, manipulating and decorating flat ntuples.
 
+The outputs can be written with a compression profile (see 
+:func:`~loki.core.process.get_compression_settings`) and variables can 
+be stored with reduced precision (see *nbits* in :class:`~loki.core.var.VarBase`). 
+Use :func:`benchmark_ntup` to compare size, write and read speed. 
+
 """
 __author__    = "Will Davey"
 __email__     = "will.davey@cern.ch"
@@ -18,20 +23,23 @@ __license__   = "GPL http://www.gnu.org/licenses/gpl.html"
 import os
 import shutil
 import tempfile
+import time
 from array import array
 from ROOT import TFile, TTree
 #from loki.core.helpers import ProgressBar
 from loki.core.logger import log
-from loki.core.process import tree2arrays, array2tree, arrays2tree
+from loki.core.process import tree2arrays, array2tree, arrays2tree, \
+    open_output_file, set_tree_compression, process_selector, \
+    HistCfg, SelectorCfg, COMPRESSION_PROFILES
 from loki.core.sample import Sample
-from loki.core.var import Weights, StaticExpr
+from loki.core.var import Weights, StaticExpr, get_leaftype
 #from loki.train.alg import AlgWorkspace
 #from loki.train.tree import TreeData
 
 
 # - - - - - - - - - - - - - - - function defs - - - - - - - - - - - - - - - - #
 #______________________________________________________________________________=buf=
-def flatten_ntup(sample, invars, sel=None, fout=None, useweight=False):
+def flatten_ntup(sample, invars, sel=None, fout=None, useweight=False, compression=None):
     """Convert mutlti-MxAOD sample into single flat ntuple
     
     Flattened ntuples are used in the mva training module as they are easier 
@@ -55,6 +63,13 @@ def flatten_ntup(sample, invars, sel=None, fout=None, useweight=False):
 
     Note: now includes sequential output writing
 
+    Variables are written with their storage precision (see *nbits* in 
+    :class:`~loki.core.var.VarBase`) and the output file with the 
+    *compression* profile (see :func:`~loki.core.process.get_compression_settings`). 
+
+    Note: to write the ntuple in the same pass as the control plots of the 
+    sample, use :func:`~loki.core.process.Processor.register_ntup` instead.
+
     :param sample: input sample
     :type sample: :class:`~loki.core.sample.Sample`
     :param invars: variables to write out
@@ -65,6 +80,8 @@ def flatten_ntup(sample, invars, sel=None, fout=None, useweight=False):
     :type fout: str
     :param useweight: use sample weight and xsec scale
     :type useweight: bool
+    :param compression: output compression profile
+    :type compression: str or int
     """
     log().info("Running ntuple flattener")
     subsamples = sample.get_final_daughters()
@@ -86,7 +103,7 @@ def flatten_ntup(sample, invars, sel=None, fout=None, useweight=False):
 
     # open output file for continuous write
     log().info("Creating output tree...")
-    f = TFile.Open(fout,"RECREATE")
+    f = open_output_file(fout, compression)
     tout = TTree(sample.treename,"Flat MxAOD")
 
     # extract arrays for each sub-sample and write to *tout*
@@ -140,7 +157,7 @@ def flatten_ntup(sample, invars, sel=None, fout=None, useweight=False):
 
 
 #______________________________________________________________________________=buf=
-def skim_ntup(fin=None, fout=None, sel=None):
+def skim_ntup(fin=None, fout=None, sel=None, compression=None):
     """Apply skimming selection to a flattened ntup
     
     :param fin: filename of input ntuple
@@ -149,6 +166,8 @@ def skim_ntup(fin=None, fout=None, sel=None):
     :type fout: str
     :param sel: selection
     :type sel: :class:`~loki.core.var.VarBase`
+    :param compression: output compression profile (default: ROOT default)
+    :type compression: str or int
     """
     log().info("Running ntuple skimmer")
     
@@ -183,7 +202,8 @@ def skim_ntup(fin=None, fout=None, sel=None):
     log().info("Output file: {0}".format(fout))
     log().info( "Old tree entries: {0:d}".format(tree.GetEntries()))
     log().info("Applying selection: {0}".format(selstr))
-    fout = TFile.Open(fout,"RECREATE")
+    fout = open_output_file(fout, compression)
+    set_tree_compression(tree, compression)
     newtree = tree.CopyTree(selstr)
     log().info( "New tree entries: {0:d}".format(newtree.GetEntries()))
     fout.WriteTObject(newtree, newtree.GetName(), "Overwrite")
@@ -192,7 +212,7 @@ def skim_ntup(fin=None, fout=None, sel=None):
 
 
 #______________________________________________________________________________=buf=
-def split_ntup(fin=None, fout1=None, fout2=None, cut1=None):
+def split_ntup(fin=None, fout1=None, fout2=None, cut1=None, compression=None):
     """Split flat ntuple (*fin*) into two independent sub-samples (*fout1*, *fout2*)
     
     The expression to select events for *fout1* can be specified (*cut1*).
@@ -210,6 +230,8 @@ def split_ntup(fin=None, fout1=None, fout2=None, cut1=None):
     :type fout2: str    
     :param cut1:  selection for first output (default "Entry$ % 2 == 0")
     :type cut1: :class:`~loki.core.var.VarBase`
+    :param compression: output compression profile (default: ROOT default)
+    :type compression: str or int
     """
     log().info("Running ntuple splitter")
     
@@ -225,14 +247,15 @@ def split_ntup(fin=None, fout1=None, fout2=None, cut1=None):
     # read in
     f = TFile.Open(fin)
     t = f.Get(tname)
+    set_tree_compression(t, compression)
     # tree 1
-    f1 = TFile.Open(fout1,"RECREATE")
+    f1 = open_output_file(fout1, compression)
     t1 = t.CopyTree(cut1)
     f1.WriteTObject(t1,t1.GetName(),"Overwrite")
     f1.Close()
     log().info(f"{fout1} written!")
     # tree 2
-    f2 = TFile.Open(fout2,"RECREATE")
+    f2 = open_output_file(fout2, compression)
     t2 = t.CopyTree(cut2)
     f2.WriteTObject(t2,t2.GetName(),"Overwrite")
     f2.Close()
@@ -240,15 +263,26 @@ def split_ntup(fin=None, fout1=None, fout2=None, cut1=None):
 
 
 #______________________________________________________________________________=buf=
-def decorate_ntup(fin=None, alg=None, overwrite=False, **kw):
+def decorate_ntup(fin=None, alg=None, overwrite=False, compression=None, 
+                  nbits=None, storage_range=None, **kw):
     """Decorate mv algorithm output onto flat ntuple
 
+    The decorated ntuple keeps the compression of the input unless a 
+    *compression* profile is given. The decoration can be stored with 
+    reduced precision (*nbits*, *storage_range*, see :func:`~loki.core.var.get_leaftype`). 
+
     :param fin: filename of input ntuple
     :type fin: str
     :param alg: algorithm
     :type alg: :class:`~loki.train.alg.AlgBase` subclass    
     :param overwrite: force overwrite if deco var already exists in input
     :type overwrite: bool
+    :param compression: output compression profile
+    :type compression: str or int
+    :param nbits: number of bits for reduced-precision storage of the decoration
+    :type nbits: int
+    :param storage_range: value range (xmin, xmax) of the decoration
+    :type storage_range: tuple (float, float)
     :param kw: key word args passed to the alg predict function
     """
     log().info("Running ntuple decorator")
@@ -286,11 +320,14 @@ def decorate_ntup(fin=None, alg=None, overwrite=False, **kw):
     t = f.Get("CollectionTree")
     temp_path = os.path.join(tempfile.mkdtemp(prefix='loki_'), 
                              next(tempfile._get_candidate_names()))
-    fnew = TFile.Open(temp_path,"RECREATE")
+    if compression is None: 
+        compression = f.GetCompressionSettings()
+    fnew = open_output_file(temp_path, compression)
     #if s.has_varname(brname): t.SetBranchStatus(brname, 0)# THIS BREAKS TREE WRITE!
     if t.GetBranch(brname): t.SetBranchStatus(brname, 0)
+    set_tree_compression(t, compression)
     tnew = t.CopyTree("") # should we use t.CloneTree()?
-    array2tree(brarray, brname, tnew)
+    array2tree(brarray, brname, tnew, get_leaftype(brarray.typecode, nbits, storage_range))
     fnew.WriteTObject(tnew,tnew.GetName(),"Overwrite")
     fnew.Close()
     f.Close()
@@ -302,4 +339,137 @@ def decorate_ntup(fin=None, alg=None, overwrite=False, **kw):
     return True
 
 
+#______________________________________________________________________________=buf=
+def benchmark_ntup(fin=None, profiles=None, nbits=None, outdir=None, nevents=None):
+    """Benchmark size, write and read speed of compression profiles on ntuple *fin*
+    
+    The ntuple is read once into memory and rewritten with each compression 
+    profile (default: all of :data:`~loki.core.process.COMPRESSION_PROFILES`). 
+    If *nbits* is given, each profile is also written with all float branches 
+    stored in reduced precision (truncated mantissa, see :func:`~loki.core.var.get_leaftype`). 
+    The read speed is measured with :func:`~loki.core.process.tree2arrays`, 
+    ie. the same path used to read the inputs for training, and with a 
+    LokiSelector filling a hist per branch (see :func:`time_loki_read`), 
+    ie. the path used to make plots. The latter is also measured with a 
+    warm column cache ("cached"). Float16 branches (reduced precision) 
+    can't be bulk read, so without the column cache the selector reads 
+    them on the slower TTreeFormula path. 
+    
+    :param fin: filename of input ntuple
+    :type fin: str
+    :param profiles: compression profiles
+    :type profiles: list str
+    :param nbits: number of bits for reduced-precision variant 
+    :type nbits: int
+    :param outdir: directory for the benchmark outputs (default: temporary, removed)
+    :type outdir: str
+    :param nevents: maximum number of events
+    :type nevents: int
+    :rtype: list dict
+    """
+    log().info("Running ntuple benchmark")
+    log().info(f"Ntup  : {fin}")        
+    if not fin or not os.path.exists(fin): 
+        log().error(f"Input file {fin} does not exist")
+        return None
+    profiles = profiles or list(COMPRESSION_PROFILES)
+    tname = "CollectionTree"
+
+    # read input into memory
+    f = TFile.Open(fin)
+    t = f.Get(tname)
+    if not t: 
+        log().error(f"tree {tname} not found in input file {fin}")
+        f.Close()
+        return None
+    brnames = [b.GetName() for b in t.GetListOfBranches()]
+    invars = [StaticExpr(b, temp=True) for b in brnames]
+    arrays = tree2arrays(t, invars, nevents=nevents)
+    f.Close()
+    if arrays is None: return None
+    nev = len(arrays[0][1]) if arrays else 0
+    log().info(f"Read {len(brnames)} branches, {nev} events")
+
+    # configs (profile, nbits)
+    configs = [(p, None) for p in profiles]
+    if nbits: configs += [(p, nbits) for p in profiles]
+
+    tempdir = None
+    if not outdir: outdir = tempdir = tempfile.mkdtemp(prefix='loki_')
+    results = []
+    for (profile, nb) in configs: 
+        label = profile if nb is None else f"{profile}_f{nb}"
+        fname = os.path.join(outdir, f"bench_{label}.root")
+        outvars = [StaticExpr(v.get_name(), temp=True, nbits=nb) for (v,_) in arrays]
+
+        # write
+        ti = time.time()
+        fout = open_output_file(fname, profile)
+        tout = TTree(tname, "Flat MxAOD")
+        arrays2tree(list(zip(outvars, [a for (_,a) in arrays])), tout)
+        fout.WriteTObject(tout, tout.GetName(), "Overwrite")
+        fout.Close()
+        twrite = time.time() - ti
+
+        # read 
+        ti = time.time()
+        f = TFile.Open(fname)
+        tree2arrays(f.Get(tname), [StaticExpr(b, temp=True) for b in brnames])
+        f.Close()
+        tread = time.time() - ti
+
+        # read with LokiSelector (without and with warm column cache)
+        tloki = time_loki_read(fname, tname, brnames)
+        colcache = os.path.join(outdir, f"colcache_{label}")
+        time_loki_read(fname, tname, brnames, colcache=colcache)
+        tcached = time_loki_read(fname, tname, brnames, colcache=colcache)
+        shutil.rmtree(colcache, ignore_errors=True)
+
+        results.append({"profile": profile, "nbits": nb, "file": fname, 
+                        "size": os.path.getsize(fname), "write": twrite, "read": tread, 
+                        "read_loki": tloki, "read_loki_cached": tcached, 
+                        "nevents": nev})
+
+    # summary
+    log().info(f"{'profile':<16} {'size [MB]':>10} {'write [s]':>10} {'read [s]':>10} "
+               f"{'loki [s]':>10} {'cached [s]':>10}")
+    for r in results: 
+        label = r["profile"] if r["nbits"] is None else f"{r['profile']} (f{r['nbits']})"
+        log().info(f"{label:<16} {r['size']/1.e6:>10.2f} {r['write']:>10.2f} {r['read']:>10.2f} "
+                   f"{r['read_loki']:>10.2f} {r['read_loki_cached']:>10.2f}")
+
+    if tempdir: 
+        shutil.rmtree(tempdir)
+        for r in results: r["file"] = None
+    return results
+
+
+#______________________________________________________________________________=buf=
+def time_loki_read(fname, tname, brnames, colcache=None):
+    """Return time [s] to read branches *brnames* of tree *tname* in *fname* with a LokiSelector
+    
+    A single-bin hist is filled per branch (see :func:`~loki.core.process.process_selector`), 
+    so the selector takes the bulk-read fast path where possible. 
+    
+    :param fname: filename of input ntuple
+    :type fname: str
+    :param tname: tree name
+    :type tname: str
+    :param brnames: branch names
+    :type brnames: list str
+    :param colcache: column cache dir (see :class:`~loki.core.process.Processor`)
+    :type colcache: str
+    :rtype: float
+    """
+    fout = fname.replace(".root", "_hists.root")
+    scfg = SelectorCfg(fin=fname, fout=fout, tname=tname, colcache=colcache)
+    for b in brnames: 
+        scfg.add(HistCfg(hash=f"h_{b}", xexpr=b, xbins=[0., 1.]))
+    ti = time.time()
+    process_selector(scfg)
+    tread = time.time() - ti
+    if os.path.exists(fout): os.remove(fout)
+    return tread
+
+
 ## EOF
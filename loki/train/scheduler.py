@@ -0,0 +1,220 @@
+# encoding: utf-8
+"""
+loki.train.scheduler.py
+~~~~~~~~~~~~~~~~~~~~~~~
+
+Resource-aware scheduling of alg training jobs on the local machine.
+
+Each training job declares its thread demand and memory estimate
+(see :func:`~loki.train.alg.AlgBase.get_resources`). The
+:class:`LocalScheduler` packs the jobs onto the available cores and
+memory without oversubscription, launching a dedicated process per job
+with its thread count pinned via the standard OpenMP/BLAS environment
+variables. Jobs reading the same input data (same *key*) are scheduled
+back-to-back so that grid points can share the prepared training data
+(see :mod:`loki.train.dataset`).
+
+"""
+__author__    = "Will Davey"
+__email__     = "will.davey@cern.ch"
+__created__   = "2026-10-17"
+__copyright__ = "Copyright 2026 Will Davey"
+__license__   = "GPL http://www.gnu.org/licenses/gpl.html"
+
+
+## modules
+import os
+import sys
+import time
+from multiprocessing import Process, cpu_count
+from multiprocessing.connection import wait
+from loki.core.logger import log
+
+
+# - - - - - - - - - - - - - - - - globals - - - - - - - - - - - - - - - - - - #
+#: environment variables used to cap the thread count of a job
+THREAD_ENV_VARS = ["OMP_NUM_THREADS", "OPENBLAS_NUM_THREADS", "MKL_NUM_THREADS"]
+
+
+# - - - - - - - - - - - - - - -  class defs - - - - - - - - - - - - - - - - - #
+#------------------------------------------------------------------------------=buf=
+class Job(object):
+    """Simple container for a scheduled job
+
+    :param target: function to execute in the job process, called as target(*args, nthreads=n)
+    :type target: callable
+    :param args: positional args passed to *target*
+    :type args: tuple
+    :param nthreads: number of threads required
+    :type nthreads: int
+    :param mem: memory estimate [MB]
+    :type mem: float
+    :param key: data key, jobs with the same key are scheduled together
+    :type key: str
+    :param name: job name (for logging)
+    :type name: str
+    """
+    #__________________________________________________________________________=buf=
+    def __init__(self, target, args=None, nthreads=None, mem=None, key=None, name=None):
+        self.target = target
+        self.args = args or ()
+        self.nthreads = max(1, int(nthreads or 1))
+        self.mem = float(mem or 0.)
+        self.key = key or ""
+        self.name = name or str(self.args)
+
+        # members
+        self.proc = None
+        self.tstart = None
+        self.status = None
+
+
+#------------------------------------------------------------------------------=buf=
+class LocalScheduler(object):
+    """Packs jobs onto local cores and memory without oversubscription
+
+    Jobs are added via :func:`add` and executed via :func:`run`.
+    Pending jobs are ordered by data key, so grid points built on the
+    same inputs run back-to-back, and within each key by decreasing
+    thread demand (first-fit decreasing packing). Whenever resources
+    are freed, the first pending job that fits is launched. A job
+    demanding more than the total resources is clamped to the total
+    and only launched on an idle node.
+
+    The scheduler waits on the job process sentinels, so completed jobs
+    are picked up immediately rather than on a fixed polling interval.
+
+    :param ncores: number of cores available (default: all, negative: all but |n|)
+    :type ncores: int
+    :param memory: memory available [MB] (default: 90% of physical memory)
+    :type memory: float
+    """
+    #__________________________________________________________________________=buf=
+    def __init__(self, ncores=None, memory=None):
+        self.ncores = get_ncores(ncores)
+        self.memory = float(memory) if memory else 0.9 * get_total_memory()
+
+        # members
+        self.pending = []
+        self.running = []
+        self.finished = []
+
+    #__________________________________________________________________________=buf=
+    def add(self, job):
+        """Add job to the queue
+
+        :param job: job
+        :type job: :class:`Job`
+        """
+        if job.nthreads > self.ncores:
+            log().warn(f"Job {job.name} requests {job.nthreads} threads, clamping to {self.ncores}")
+            job.nthreads = self.ncores
+        self.pending.append(job)
+
+    #__________________________________________________________________________=buf=
+    def run(self):
+        """Execute all jobs, returning the number of failures"""
+        if not self.pending: return 0
+        self.pending.sort(key=lambda j: (j.key, -j.nthreads, -j.mem))
+        njobs = len(self.pending)
+        log().info(f"Scheduling {njobs} jobs on {self.ncores} cores, {self.memory/1024.:.1f} GB")
+
+        failures = 0
+        while self.pending or self.running:
+            # launch as many jobs as fit
+            while self.__launch_next__(): pass
+
+            # wait for at least one job to complete
+            sentinels = {j.proc.sentinel: j for j in self.running}
+            for s in wait(list(sentinels.keys())):
+                job = sentinels[s]
+                job.proc.join()
+                job.status = (job.proc.exitcode == 0)
+                self.running.remove(job)
+                self.finished.append(job)
+                dt = time.time() - job.tstart
+                nleft = len(self.pending) + len(self.running)
+                if not job.status:
+                    failures += 1
+                    log().error(f"Job {job.name} failed after {dt:.0f} s! {nleft} left")
+                else:
+                    log().info(f"Job {job.name} finished in {dt:.0f} s! {nleft} left")
+        return failures
+
+    #__________________________________________________________________________=buf=
+    def get_free_cores(self):
+        """Return number of unallocated cores"""
+        return self.ncores - sum([j.nthreads for j in self.running])
+
+    #__________________________________________________________________________=buf=
+    def get_free_memory(self):
+        """Return unallocated memory [MB]"""
+        return self.memory - sum([j.mem for j in self.running])
+
+    #__________________________________________________________________________=buf=
+    def __launch_next__(self):
+        """Launch the first pending job that fits, return True if launched
+
+        Jobs sharing a data key with a running job are preferred.
+        """
+        free_cores = self.get_free_cores()
+        free_mem = self.get_free_memory()
+        running_keys = set([j.key for j in self.running])
+        fits = [j for j in self.pending
+                if j.nthreads <= free_cores and (j.mem <= free_mem or not self.running)]
+        if not fits: return False
+        preferred = [j for j in fits if j.key in running_keys]
+        job = (preferred or fits)[0]
+        self.pending.remove(job)
+        self.__launch__(job)
+        return True
+
+    #__________________________________________________________________________=buf=
+    def __launch__(self, job):
+        """Start process for *job*"""
+        job.proc = Process(target=run_job, args=(job.target, job.args, job.nthreads))
+        job.proc.start()
+        job.tstart = time.time()
+        self.running.append(job)
+        log().debug(f"Launched {job.name} ({job.nthreads} threads, {job.mem:.0f} MB)")
+
+
+# - - - - - - - - - - - - - - - function defs - - - - - - - - - - - - - - - - #
+#______________________________________________________________________________=buf=
+def run_job(target, args, nthreads):
+    """Execute *target* in job process with thread count capped to *nthreads*"""
+    for var in THREAD_ENV_VARS:
+        os.environ[var] = str(nthreads)
+    try:
+        status = target(*args, nthreads=nthreads)
+    except Exception as e:
+        sys.__stderr__.write(f"Job failed with exception: {e}\n")
+        status = False
+    sys.exit(0 if status else 1)
+
+
+#______________________________________________________________________________=buf=
+def get_ncores(ncores=None):
+    """Return number of cores to use
+
+    If not specified, all available cores are used. If negative,
+    all but `|n|` cores are used.
+    """
+    if hasattr(os, "sched_getaffinity"): navail = len(os.sched_getaffinity(0))
+    else:                                navail = cpu_count()
+    if not ncores:   return navail
+    elif ncores < 0: return max(1, navail + ncores)
+    return min(ncores, navail)
+
+
+#______________________________________________________________________________=buf=
+def get_total_memory():
+    """Return total physical memory [MB]"""
+    try:
+        return os.sysconf("SC_PAGE_SIZE") * os.sysconf("SC_PHYS_PAGES") / 1024.**2
+    except (ValueError, OSError, AttributeError):
+        log().warn("Couldn't determine physical memory, assuming 4 GB")
+        return 4096.
+
+
+## EOF
@@ -0,0 +1,121 @@
+# encoding: utf-8
+"""
+loki.utils.daemon.py
+~~~~~~~~~~~~~~~~~~~~
+
+Subparser and subcommands for *loki daemon*, which control the warm
+processing daemon (see :mod:`loki.core.daemon`):
+
+* start: start the daemon (in the foreground, or detached with ``--detach``)
+* stop: stop the daemon
+* status: print daemon status
+
+"""
+__author__    = "Will Davey"
+__email__     = "will.davey@cern.ch"
+__created__   = "2026-10-17"
+__copyright__ = "Copyright 2026 Will Davey"
+__license__   = "GPL http://www.gnu.org/licenses/gpl.html"
+
+
+
+## modules
+
+
+# - - - - - - - - - - - - - - - function defs - - - - - - - - - - - - - - - - #
+#______________________________________________________________________________=buf=
+def subparser_daemon(subparsers):
+    """Subparser for *loki daemon*"""
+    parser_daemon = subparsers.add_parser("daemon", help="warm processing daemon",
+        description="Control the warm processing daemon used by 'loki plot --daemon'")
+    subparsers_daemon = parser_daemon.add_subparsers(help="loki daemon sub-command")
+
+    ## loki daemon start
+    ##------------------
+    parser_start = subparsers_daemon.add_parser("start",
+        help="start the daemon", description="Starts the processing daemon")
+    parser_start.add_argument( "-n", "--ncores", dest="ncores", type=int,
+        help="Number of worker processes. If negative use all but |n| cores. (default: use all available cores)" )
+    parser_start.add_argument( "--max-files", dest="max_files", type=int, default=32,
+        metavar="N", help="Keep up to N input files open per worker (default: 32)" )
+    parser_start.add_argument( "--detach", dest="detach", action="store_true", default=False,
+        help="Run the daemon in the background (log to ~/.lokicache/daemon.log)" )
+    __add_socket_arg__(parser_start)
+    parser_start.set_defaults(command=command_start)
+
+    ## loki daemon stop
+    ##-----------------
+    parser_stop = subparsers_daemon.add_parser("stop",
+        help="stop the daemon", description="Stops the processing daemon")
+    __add_socket_arg__(parser_stop)
+    parser_stop.set_defaults(command=command_stop)
+
+    ## loki daemon status
+    ##-------------------
+    parser_status = subparsers_daemon.add_parser("status",
+        help="print daemon status", description="Prints the processing daemon status")
+    __add_socket_arg__(parser_status)
+    parser_status.set_defaults(command=command_status)
+
+
+#______________________________________________________________________________=buf=
+def __add_socket_arg__(parser):
+    """Add daemon socket argument to *parser*"""
+    parser.add_argument( "--socket", dest="socket", metavar="PATH",
+        help="Daemon socket PATH (default: ~/.lokicache/daemon.sock)" )
+
+
+#____________________________________________________________
+def command_start(args):
+    """Subcommand for *loki daemon start*"""
+    if args.detach:
+        import os
+        import subprocess
+        import sys
+        from loki.core.daemon import get_default_address
+        from loki.core.helpers import mkdir_p
+        cmd = [a for a in sys.argv if a != "--detach"]
+        flog = os.path.join(os.getenv('HOME'), ".lokicache", "daemon.log")
+        mkdir_p(os.path.dirname(flog))
+        with open(flog, "a") as f:
+            p = subprocess.Popen([sys.executable] + cmd, stdout=f, stderr=subprocess.STDOUT,
+                                 stdin=subprocess.DEVNULL, start_new_session=True)
+        print(f"Started loki daemon (pid {p.pid}) on {args.socket or get_default_address()}, log: {flog}")
+        return
+
+    from loki.core.setup import setup
+    setup()
+    from loki.core.daemon import ProcessingDaemon
+    ProcessingDaemon(address=args.socket, ncores=args.ncores, max_files=args.max_files).serve()
+
+
+#____________________________________________________________
+def command_stop(args):
+    """Subcommand for *loki daemon stop*"""
+    from loki.core.daemon import DaemonClient, daemon_running
+    client = DaemonClient(args.socket)
+    if not daemon_running(client.address):
+        print(f"No loki daemon running on {client.address}")
+        return
+    status = client.stop()
+    print(f"Stopped loki daemon (pid {status['pid']}) after {status['nrequests']} requests")
+
+
+#____________________________________________________________
+def command_status(args):
+    """Subcommand for *loki daemon status*"""
+    from loki.core.daemon import DaemonClient, daemon_running
+    client = DaemonClient(args.socket)
+    if not daemon_running(client.address):
+        print(f"No loki daemon running on {client.address}")
+        return
+    status = client.status()
+    print(f"loki daemon on {status['address']}")
+    print(f"  pid        : {status['pid']}")
+    print(f"  workers    : {status['ncores']} ({status['busy']} busy)")
+    print(f"  uptime     : {status['uptime']:.0f} s")
+    print(f"  requests   : {status['nrequests']}")
+    print(f"  selectors  : {status['nselectors']}")
+
+
+## EOF
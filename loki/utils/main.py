@@ -18,6 +18,7 @@ The following subcommands are currently available:
 * wpplot: working point comparison plots
 * pdfbook: make pdf plotbooks
 * webbook: make web plotbooks
+* daemon: warm processing daemon (start, stop, status)
 * dev: development tools (new, log, list-tags, tag, rel)  
 
 Deprecated: 
@@ -45,6 +46,7 @@ from .plot import subparser_plot
 from .quickplot import subparser_quickplot
 from .latex import subparser_pdfbook
 from .root2html import subparser_webbook
+from .daemon import subparser_daemon
 from .ntup import subparser_ntup
 from .mvaplot import subparser_mvaplot
 from .wpplot import subparser_wpplot
@@ -72,6 +74,7 @@ def main():
     subparser_wpplot(subparsers)
     subparser_pdfbook(subparsers)
     subparser_webbook(subparsers)
+    subparser_daemon(subparsers)
     subparser_dev(subparsers)
     
     # parser args
@@ -48,6 +48,10 @@ def subparser_mv(subparsers):
         help="Force retrain previously trained algs" )
     parser_train.add_argument( "--pbs", dest="pbs", nargs='?', const="medium", metavar="QUEUE", 
         help="Submit to pbs QUEUE (default queue: medium)" )
+    parser_train.add_argument( "-j", "--ncores", dest="ncores", type=int, metavar="N", 
+        help="Number of local cores to use (negative: all but N)" )
+    parser_train.add_argument( "-m", "--memory", dest="memory", type=float, metavar="MB", 
+        help="Local memory budget in MB (default: 90%% of physical memory)" )
     parser_train.set_defaults(command=command_train)
 
     ## loki mv grid
@@ -136,7 +140,8 @@ def command_train(args):
             exit(1)
     else: 
         from loki.train.alg import train_local
-        if not train_local(algs, retrain=args.retrain): 
+        if not train_local(algs, retrain=args.retrain, ncores=args.ncores, 
+                           memory=args.memory): 
             log().error("Failure processing algs")
             exit(1)
 
@@ -19,6 +19,9 @@ __license__   = "GPL http://www.gnu.org/licenses/gpl.html"
 from loki.core.logger import log
 from .helpers import loki_setup, get_sel, start_timer, stop_timer
 
+#: compression profiles (see :data:`loki.core.process.COMPRESSION_PROFILES`)
+COMPRESSION_PROFILES = ["default", "fast", "small"]
+
 # - - - - - - - - - - - - - - - function defs - - - - - - - - - - - - - - - - #
 #______________________________________________________________________________=buf=
 def subparser_ntup(subparsers):
@@ -45,6 +48,8 @@ def subparser_ntup(subparsers):
         help="Comma-separated list of SELection (eg. 'TauJets.baseline1P'" )
     parser_flat.add_argument( "--useweight", dest="useweight", action="store_true", 
         help="Toggle sub-sample weights and xsec scaling" )    
+    parser_flat.add_argument( "--compression", dest="compression", choices=COMPRESSION_PROFILES, 
+        help="output compression profile (fast: LZ4, small: ZSTD, default: ROOT default)" )
     #parser_flat.add_argument( "-c", "--config", dest="config", 
     #    metavar="CONFIG", help="path to python CONFIG script to override defaults" )         
     parser_flat.add_argument( "-v", "--verbose", dest="verbose", action="store_true", 
@@ -62,6 +67,8 @@ def subparser_ntup(subparsers):
         metavar="OUTPUT", help="OUTPUT ROOT file name (default: skim.root)" )
     parser_skim.add_argument( "--sel", dest="sel", metavar="SEL", 
         help="Comma-separated list of SELection (eg. 'TauJets.baseline1P'" )
+    parser_skim.add_argument( "--compression", dest="compression", choices=COMPRESSION_PROFILES, 
+        help="output compression profile (fast: LZ4, small: ZSTD, default: ROOT default)" )
     parser_skim.add_argument( "-v", "--verbose", dest="verbose", action="store_true", 
         help="Toggle verbose output" )
     parser_skim.set_defaults(command=command_skim)
@@ -77,10 +84,27 @@ def subparser_ntup(subparsers):
         help="Second (testing) output path (default: <FILE>_test.root)" )
     parser_split.add_argument( "-e", "--expr", dest="expr", metavar="EXPR", 
         help="EXPRession to select events for OUTFILE1 (default: 'Entry$ %% 2 == 0', ie every second entry)" )
+    parser_split.add_argument( "--compression", dest="compression", choices=COMPRESSION_PROFILES, 
+        help="output compression profile (fast: LZ4, small: ZSTD, default: ROOT default)" )
     parser_split.add_argument( "-v", "--verbose", dest="verbose", action="store_true", 
         help="Toggle verbose output" )
     parser_split.set_defaults(command=command_split)
 
+    ## loki ntup bench
+    ##----------------
+    parser_bench = subparsers_ntup.add_parser("bench", help="ntuple storage benchmark", 
+        description="Benchmark size, write and read speed of the compression profiles")
+    parser_bench.add_argument( "file", metavar="FILE", help="input FILE path" )
+    parser_bench.add_argument( "--profiles", dest="profiles", metavar="PROFILES", 
+        help="comma-separated list of compression PROFILES (default: all)" )
+    parser_bench.add_argument( "--nbits", dest="nbits", type=int, metavar="NBITS", 
+        help="also benchmark reduced-precision floats with NBITS mantissa bits" )
+    parser_bench.add_argument( "-n", "--nevents", dest="nevents", type=int, metavar="NEVENTS", 
+        help="maximum number of events" )
+    parser_bench.add_argument( "-v", "--verbose", dest="verbose", action="store_true", 
+        help="Toggle verbose output" )
+    parser_bench.set_defaults(command=command_bench)
+
     ## loki ntup weight
     ##-----------------
     parser_weight = subparsers_ntup.add_parser("weight", help="ntuple weighter", 
@@ -194,7 +218,8 @@ def command_flat(args):
     
     # run writer
     from loki.train.ntup import flatten_ntup
-    flatten_ntup(SAMPLE, INVARS, sel=SEL, fout=args.output, useweight=args.useweight)
+    flatten_ntup(SAMPLE, INVARS, sel=SEL, fout=args.output, useweight=args.useweight, 
+                 compression=args.compression)
     
     log().info("Finished dominating!")
     stop_timer(ti)
@@ -212,6 +237,7 @@ def command_skim(args):
     skim_ntup(fin = args.file,
               fout = args.output, 
               sel = sel,
+              compression = args.compression,
                )
     log().info("Finished dominating!")
     stop_timer(ti)
@@ -229,12 +255,34 @@ def command_split(args):
                fout1 = args.fout1,
                fout2 = args.fout2,
                cut1 = args.expr,
+               compression = args.compression,
                )
     
     log().info("Finished dominating!")
     stop_timer(ti)
     
 
+#____________________________________________________________
+def command_bench(args):
+    """Subcommand for *loki ntup bench*"""
+    
+    loki_setup(args.verbose)
+    ti = start_timer()
+    
+    from loki.train.ntup import benchmark_ntup
+    profiles = args.profiles.split(",") if args.profiles else None
+    if benchmark_ntup(fin = args.file,
+                      profiles = profiles, 
+                      nbits = args.nbits, 
+                      nevents = args.nevents,
+                      ) is None: 
+        log().error("Failed to benchmark")
+        exit(1)
+    
+    log().info("Finished dominating!")
+    stop_timer(ti)
+    
+
 #____________________________________________________________
 def command_weight(args):
     """Subcommand for *loki ntup weight*    
@@ -30,6 +30,12 @@ def subparser_plot(subparsers):
         metavar="OUTPUT", help="OUTPUT ROOT file name (default: canvases.root)" )
     parser.add_argument( "-e", "--event-frac", dest="event_frac", type=float, 
         metavar="FRAC", help="Specify a limited FRAC of events to process" )
+    parser.add_argument( "--precision", dest="precision", type=float, 
+        metavar="REL", help="Stop processing once all hists reach relative per-bin uncertainty REL (overrides --event-frac)" )
+    parser.add_argument( "--precision-eff", dest="precision_eff", type=float, 
+        metavar="ERR", help="Stop processing once all efficiency points reach uncertainty ERR (overrides --event-frac)" )
+    parser.add_argument( "--preview", dest="preview", type=float, nargs="?", const=0.01,
+        metavar="FRAC", help="Draw preview plots from FRAC of events (default: 0.01) first, then refine while processing continues" )
     parser.add_argument( "-s", "--sample", dest="signal", default="sample",
         metavar="SIGNAL", help="Specify the SIGNAL sample name (default: sample)" )
     parser.add_argument( "-b", "--bkg", dest="background", default="bkg",
@@ -48,6 +54,20 @@ def subparser_plot(subparsers):
         help="Switch off histogram caching" )                  
     parser.add_argument( "--usedraw", dest="usedraw", action="store_true", default=False, 
         help="Switch old TTree::Draw based Processor" )
+    parser.add_argument( "--telemetry", dest="telemetry", metavar="FILE",
+        help="Write processing telemetry to FILE (Chrome trace JSON, view in chrome://tracing or Perfetto)" )
+    parser.add_argument( "--pipeline", dest="pipeline", action="store_true", default=False,
+        help="Read and decompress the next cluster on a helper thread while filling (flat ntuples only)" )
+    parser.add_argument( "--daemon", dest="daemon", nargs="?", const=True, metavar="SOCKET",
+        help="Process on the warm daemon (see 'loki daemon start') at SOCKET (default: ~/.lokicache/daemon.sock)" )
+    parser.add_argument( "--colcache", dest="colcache", action="store_true", default=False,
+        help="Cache decoded input columns in ~/.lokicache/columns for faster reprocessing" )
+    parser.add_argument( "--executor", dest="executor", choices=["local", "pbs", "condor"],
+        help="Run selectors as standalone jobs locally or on a PBS/HTCondor batch system (requires scripts/build_lokirun.sh)" )
+    parser.add_argument( "--queue", dest="queue", 
+        help="Batch queue for --executor pbs (default: medium) or job flavour for condor" )
+    parser.add_argument( "--render", dest="render", type=int, metavar="N",
+        help="Draw and save plots in N parallel worker processes (negative: all but |N| cores)" )
     parser.add_argument( "--nologos", dest="nologos", action="store_true",
         help="Switch off completely awesome THOR/loki logos :'(" )
     parser.add_argument( "--inprog", dest="inprog", action="store_true",
@@ -188,10 +208,23 @@ def command_plot(args):
     # process
     if not args.usedraw: 
         from loki.core.process import Processor
+        executor = None
+        if args.executor: 
+            from loki.core.executor import get_executor
+            executor = get_executor(args.executor, ncores=args.ncores, queue=args.queue)
         p = Processor(event_frac=args.event_frac,
                       ncores=args.ncores,
                       noweight=args.noweight,
                       usecache=args.usecache,
+                      telemetry=args.telemetry,
+                      pipeline=args.pipeline,
+                      precision=args.precision,
+                      precision_eff=args.precision_eff,
+                      preview=args.preview,
+                      render=args.render,
+                      daemon=args.daemon,
+                      executor=executor,
+                      colcache=args.colcache,
                       )   
     else: 
         from loki.core._depr_process import Processor
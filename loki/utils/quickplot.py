@@ -40,6 +40,8 @@ def subparser_quickplot(subparsers):
         help="Set log scale on y-axis" )
     parser.add_argument( "--noweight", dest="noweight", action="store_true", default = False,
         help="Turn off sample weighting" )
+    parser.add_argument( "--preview", dest="preview", type=float, nargs="?", const=0.01,
+        metavar="FRAC", help="Draw preview plot from FRAC of events (default: 0.01) first, then refine while processing continues" )
     # parser.add_argument( "-n", "--ncores", dest="ncores", type=int,
     #     help="Number of processing cores. If negative use all but |n| cores. (default: use all available cores)" )
     parser.add_argument( "-v", "--verbose", dest="verbose", action="store_true",
@@ -129,7 +131,7 @@ def command_quickplot(args):
 
     # process plots
     from loki.core.process import Processor
-    proc = Processor(ncores=1, noweight=args.noweight)
+    proc = Processor(ncores=1, noweight=args.noweight, preview=args.preview)
     proc.draw_plots([p])
     
     ## write outputs to ROOT ntuple
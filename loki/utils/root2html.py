@@ -18,6 +18,17 @@ DESCRIPTION
     gif/png images for each of the plots, and generates an html page
     containing and linking all the information.
     
+    Canvases are rendered in parallel worker processes (one ROOT file
+    handle per worker). Thumbnails and gif images are generated directly
+    from the canvas with TImage, rather than converting the eps with
+    ImageMagick.
+
+    Builds are incremental: a manifest (.root2html.json) in the output
+    directory stores a content hash of each canvas (from its serialized
+    record in the ROOT file) and its caption. When rebuilding into the
+    same directory (eg. with a fixed --name), canvases whose hash and
+    outputs are unchanged are not re-rendered.
+    
     When viewing the output html, note that you can click-up more than one
     figure at a time, and drag them around the screen.  That javascript magic
     is done with the help of this library: http://highslide.com/.
@@ -42,13 +53,15 @@ __license__   = "GPL <http://www.gnu.org/licenses/gpl.html>"
 
 #------------------------------------------------------------------------------
 
-import copy
 import ctypes
+import hashlib
+import json
 import os, sys, getopt
 import shutil
 import time
 import re
 import math
+from multiprocessing import Pool, cpu_count
 import ROOT
 from .dev import DevTool
 
@@ -58,6 +71,9 @@ from .dev import DevTool
 ## global options
 quiet = True
 
+## ROOT file opened by render worker (see init_render_worker)
+_render_file = None
+
 
 #______________________________________________________________________________=buf=
 def subparser_webbook(subparsers):
@@ -76,6 +92,10 @@ def subparser_webbook(subparsers):
             help="Keep local webbook copy" )
     parser.add_argument( "-s", "--server", dest="server", 
             metavar="AFSPATH", help="AFSPATH to private server" )        
+    parser.add_argument( "-n", "--ncores", dest="ncores", type=int, 
+            help="Number of rendering processes. If negative use all but |n| cores. (default: use all available cores)" )
+    parser.add_argument( "--name", dest="name", metavar="DIR",
+            help="Output DIR name (default: DATE_USER_TAG). Use a fixed name with --keep to rebuild incrementally" )
     parser.set_defaults(command=command_webbook)
 
 
@@ -100,7 +120,7 @@ def command_webbook(args):
     ## construct basename 
     date = time.strftime('%Y-%m-%d',time.localtime())
     user = os.environ['USER']
-    basename = "{date}_{user}_{tag}".format(
+    basename = args.name or "{date}_{user}_{tag}".format(
         date = date,
         user = user,
         tag  = tag)
@@ -112,7 +132,7 @@ def command_webbook(args):
     name = os.path.join(basename, 'index.html')
     index = HighSlideRootFileIndex(name,highslide_path=highslide_path)
     index.write_head(name)
-    n_plots = index.write_root_file(path, pattern)
+    n_plots = index.write_root_file(path, pattern, ncores=args.ncores)
     index.write_foot()
     index.close()
     print(f'  {name} written.')
@@ -130,7 +150,7 @@ def command_webbook(args):
     elif args.publish:        
         # ask to publish?        
         while True: 
-            result = raw_input("Publish to loki server? [Y/n]:")
+            result = input("Publish to loki server? [Y/n]:")
             if result.lower() not in ["","n","y"]: 
                 print("Invalid option!")
                 continue
@@ -192,7 +212,7 @@ class HighSlideRootFileIndex():
                  thumb_height = 60,
             ):
         make_dir_if_needed(name)
-        super(HighSlideRootFileIndex, self).__init__(name, 'w')
+        self.f = open(name, 'w')
         self.dirname = os.path.dirname(name)
         self.highslide_path = highslide_path 
         self.previous_level = 0
@@ -201,7 +221,16 @@ class HighSlideRootFileIndex():
         self.img_format = img_format
         self.img_height = img_height
         self.thumb_height = thumb_height
+        self.fmanifest = os.path.join(self.dirname, '.root2html.json')
         
+    #__________________________________________________________________________
+    def write(self, text):
+        self.f.write(text)
+
+    #__________________________________________________________________________
+    def close(self):
+        self.f.close()
+
     #__________________________________________________________________________
     def write_head(self, title):
         head_template = r"""<!DOCTYPE html PUBLIC "-//W3C//DTD XHTML 1.0 Strict//EN"
@@ -343,36 +372,57 @@ class HighSlideRootFileIndex():
                 'user' : os.environ['USER'],
                 'date' : time.ctime() })
     #__________________________________________________________________________
-    def write_root_file(self, path, pattern=''):
-        n_plots = 0
+    def write_root_file(self, path, pattern='', ncores=None):
+        """Write html for all canvases in ROOT file *path*
+        
+        The canvases are collected first, then all new or modified 
+        canvases are rendered in a pool of *ncores* worker processes 
+        (default: all cores), and finally the html is written in the 
+        order of the file. Returns the number of canvases. 
+        """
+        ## collect canvases
+        canvases = []
         rootfile = ROOT.TFile(path)
-        for dirpath, dirnames, filenames, tdirectory in walk(rootfile):
-            for key in filenames:
-                obj = tdirectory.Get(key)
-
-                # Hack for when we find TH1, TH2 instead of TCanvas
-                new_obj = None
-                if self.dohist and (issubclass(obj.__class__, ROOT.TH1) or issubclass(obj.__class__, ROOT.TH1)):
-                #if issubclass(obj.__class__, ROOT.TH1) or issubclass(obj.__class__, ROOT.TH1):
-                    new_obj = ROOT.TCanvas(obj.GetName(), obj.GetTitle(), 500, 500)
-                    new_obj.cd()
-                    obj.Draw()
-                    obj = new_obj
-
-                # Put TCanvas on html
-                if isinstance(obj, ROOT.TCanvas):
+        with open(path, 'rb') as fraw:
+            for dirpath, dirnames, filenames, tdirectory in walk(rootfile):
+                for key in filenames:
+                    tkey = tdirectory.GetKey(key)
+                    cl = ROOT.TClass.GetClass(tkey.GetClassName())
+                    # lone hists are put onto a canvas (see render_canvas)
+                    if not (cl.InheritsFrom("TCanvas") or (self.dohist and cl.InheritsFrom("TH1"))):
+                        continue
                     root_dir_path = dirpath.split(':/')[1]
                     root_key_path = os.path.join(root_dir_path, key)
                     if pattern and not re.match(pattern, root_key_path):
                         continue
-                    print(os.path.join(dirpath, key))
-                    self.write_dir_header(dirpath)
                     full_path = os.path.join(self.dirname, root_key_path)
-                    self.write_canvas(obj, full_path)
-                    n_plots += 1
-
+                    chash = get_key_hash(fraw, tkey, self.__get_options__())
+                    canvases.append((dirpath, key, root_key_path, full_path, chash))
         rootfile.Close()
-        return n_plots
+
+        ## render new/modified canvases
+        manifest = self.__read_manifest__()
+        jobs = [(c[2], c[3], self.__get_options__()) for c in canvases 
+                if not self.__is_uptodate__(manifest.get(c[2]), c[4])]
+        print(f'  {len(canvases) - len(jobs)} / {len(canvases)} canvases unchanged')
+        results = render_canvases(path, jobs, ncores=ncores)
+
+        ## write html
+        new_manifest = dict()
+        for (dirpath, key, root_key_path, full_path, chash) in canvases:
+            if root_key_path in results: 
+                print(os.path.join(dirpath, key))
+                info = results[root_key_path]
+            else: 
+                info = manifest[root_key_path]["info"]
+            if info is None: continue
+            self.write_dir_header(dirpath)
+            self.write_canvas_html(info)
+            new_manifest[root_key_path] = {"hash": chash, "info": info}
+        with open(self.fmanifest, 'w') as f:
+            json.dump(new_manifest, f, indent=1)
+
+        return len(new_manifest)
     #__________________________________________________________________________
     def write_dir_header(self, path):
         path_split = path.split(':/')
@@ -407,53 +457,27 @@ class HighSlideRootFileIndex():
             self.pwd = dirpath
     #__________________________________________________________________________
     def write_canvas(self, canvas, basepath):
-        name = canvas.GetName()
-        make_dir_if_needed(basepath)
-        ## save eps
-        eps = basepath + '.eps'
-        canvas.SaveAs(eps)
-        ## save img
-        if self.img_format == 'gif':
-            img = self.convert_eps_to_gif(eps)
-        elif self.img_format == 'png':
-            img = eps.replace(".eps", ".png")
-            copy.copy(canvas).SaveAs(img)
-        elif self.img_format == 'svg':
-            img = eps.replace('.eps', '.svg')
-            copy.copy(canvas).SaveAs(img)
-            ## retrieve svg width, heigth (smaller than canvas)
-            with open(img, "r") as svg:
-                for line in svg:
-                    if line.startswith("<svg"):
-                        svg_width  = int(1.05*float(re.search('width="(\d*)"' , line).group(1)))
-                        svg_height = int(1.15*float(re.search('height="(\d*)"', line).group(1)))
-                        break
-                    else:
-                        continue
-        ## save thumb
-        if self.img_format == 'gif':
-            thumb = self.convert_eps_to_thumb_gif(eps)
-        elif self.img_format == 'png':
-            thumb = img
-        elif self.img_format == 'svg':
-            thumb = img.replace('.svg', '.png')
-            copy.copy(canvas).SaveAs(thumb)
-        ## additional formats, see <http://root.cern.ch/root/html/TPad.html#TPad:SaveAs>
-        formats = ['.pdf'] # ['.png', '.pdf', '.C']
-        for format in formats:
-            copy.copy(canvas).SaveAs(basepath + format)
+        """Render *canvas* to images under *basepath* and write its html"""
+        info = render_canvas(canvas, basepath, self.__get_options__())
+        self.write_canvas_html(info)
+
+    #__________________________________________________________________________
+    def write_canvas_html(self, info):
+        """Write html for canvas rendered by :func:`render_canvas`"""
+        name = info['name']
+        basepath = info['basepath']
         ## convert to relpaths
         ## use locally defined relpath because os.path.relpath does not
         ## exist in Python 2.5.
-        eps = relpath(eps, self.dirname)
-        pdf = eps.replace(".eps", ".pdf")
-        img = relpath(img, self.dirname)
-        thumb = relpath(thumb, self.dirname)
+        eps = relpath(info['eps'], self.dirname)
+        pdf = relpath(info['pdf'], self.dirname)
+        img = relpath(info['img'], self.dirname)
+        thumb = relpath(info['thumb'], self.dirname)
         ## vector graphics (svg) need a special hyperlink tag
         if not self.img_format == 'svg':
             hreftag = """ class="highslide" rel="highslide" """
         else:
-            hreftag = """ onclick="return hs.htmlExpand(this, {objectType: 'iframe', height: %s, width: %s})" """ % (svg_height, svg_width)
+            hreftag = """ onclick="return hs.htmlExpand(this, {objectType: 'iframe', height: %s, width: %s})" """ % (info['svg_height'], info['svg_width'])
         ## write xhtml
         fig_template = r"""
         <a href="%(img)s" %(hreftag)s>
@@ -479,60 +503,157 @@ class HighSlideRootFileIndex():
                 'pdf'   : pdf,
                 'img'   : img,
                 'format': self.img_format})
-        ## get stats
-        stats = get_canvas_stats(canvas)
-        if stats:
-            clean_stats_names(stats)
-            tab = convert_stats_to_table(stats)
-            html_tab = convert_table_to_html(tab)
-            self.write(caption_template % html_tab)
-
-    #______________________________________________________________________________
-    def convert_eps_to_gif(self,eps):
-        assert eps.endswith('.eps')
-        name = eps[:-3] + 'gif'
-        os.system('convert -format gif %s[x%i] %s' % (eps, self.img_height, name) )
-        if not quiet:
-            print('  Created %s' % name)
-        return name
-
-    #______________________________________________________________________________
-    def convert_eps_to_thumb_gif(self,eps):
-        assert eps.endswith('.eps')
-        name = eps[:-3] + 'thumb.gif'
-        os.system('convert -resize x%i -antialias -colors 64 -format gif %s %s' % (self.thumb_height, eps, name) )
-        if not quiet:
-            print('  Created %s' % name)
-        return name
-
-    """
-    #______________________________________________________________________________
-    def convert_eps_to_png(self,eps):
-        assert eps.endswith('.eps')
-        name = eps[:-3] + 'png'
-        os.system('convert -resize x%i -antialias -colors 64 -format png %s %s' % (self.img_height, eps, name) )
-        if not quiet:
-            print('  Created %s' % name)
-        return name
-
-    #______________________________________________________________________________
-    def convert_eps_to_thumb_png(self,eps):
-        assert eps.endswith('.eps')
-        name = eps[:-3] + 'thumb.png'
-        os.system('convert -resize x%i -antialias -colors 64 -format png %s %s' % (self.thumb_height, eps, name) )
-        if not quiet:
-            print('  Created %s' % name)
-        return name
-    """
+        ## stats
+        if info['stats']:
+            self.write(caption_template % info['stats'])
 
+    #__________________________________________________________________________
+    def __get_options__(self):
+        """Return image options passed to :func:`render_canvas`"""
+        return {'dohist': self.dohist, 
+                'img_format': self.img_format, 
+                'img_height': self.img_height, 
+                'thumb_height': self.thumb_height}
 
+    #__________________________________________________________________________
+    def __read_manifest__(self):
+        """Return manifest of previous build (empty if none)"""
+        if not os.path.exists(self.fmanifest): return dict()
+        try: 
+            with open(self.fmanifest) as f: 
+                return json.load(f)
+        except ValueError: 
+            return dict()
 
+    #__________________________________________________________________________
+    def __is_uptodate__(self, entry, chash):
+        """Return True if manifest *entry* matches *chash* and outputs exist"""
+        if not entry or entry.get("hash") != chash: return False
+        info = entry.get("info")
+        if not info: return False
+        return all([os.path.exists(info[k]) for k in ['img', 'thumb', 'eps', 'pdf']])
 
 
 #------------------------------------------------------------------------------
 # free functions
 #------------------------------------------------------------------------------
 
+#__________________________________________________________________________
+def render_canvases(path, jobs, ncores=None):
+    """Render canvases in ROOT file *path* using a pool of worker processes
+    
+    Each job is a tuple (key path, output base path, image options). 
+    Returns dict of html info from :func:`render_canvas` (key: key path).
+    """
+    if not jobs: return dict()
+    if   not ncores:  ncores = cpu_count()
+    elif ncores < 0:  ncores = max(1, cpu_count() + ncores)
+    ncores = min(ncores, len(jobs))
+    for (_, basepath, _) in jobs: 
+        make_dir_if_needed(basepath)
+    if ncores <= 1: 
+        init_render_worker(path)
+        results = [render_job(j) for j in jobs]
+    else: 
+        print(f'  rendering {len(jobs)} canvases on {ncores} cores')
+        pool = Pool(processes=ncores, initializer=init_render_worker, initargs=(path,))
+        results = pool.map(render_job, jobs, max(1, len(jobs) // (4 * ncores)))
+        pool.close()
+        pool.join()
+    return dict([(j[0], info) for (j, info) in zip(jobs, results)])
+
+#__________________________________________________________________________
+def init_render_worker(path):
+    """Open ROOT file *path* in render worker"""
+    global _render_file
+    ROOT.gROOT.SetBatch(True)
+    ROOT.gErrorIgnoreLevel = 1001
+    _render_file = ROOT.TFile.Open(path)
+
+#__________________________________________________________________________
+def render_job(job):
+    """Render canvas for *job* from the worker's ROOT file"""
+    (key_path, basepath, opts) = job
+    obj = _render_file.Get(key_path)
+    if not obj: 
+        print(f'WARNING: failed to read {key_path}')
+        return None
+    return render_canvas(obj, basepath, opts)
+
+#__________________________________________________________________________
+def render_canvas(canvas, basepath, opts):
+    """Save images of *canvas* under *basepath* and return info for the html
+    
+    Saves eps and pdf copies, the image in format *img_format* and a 
+    thumbnail. Gif images and thumbnails are made directly from the 
+    canvas via TImage. 
+    """
+    # lone hists are drawn on a canvas
+    if isinstance(canvas, ROOT.TH1): 
+        h = canvas
+        canvas = ROOT.TCanvas(h.GetName(), h.GetTitle(), 500, 500)
+        canvas.cd()
+        h.Draw()
+    img_format = opts['img_format']
+    info = {'name': canvas.GetName(), 'basepath': basepath, 
+            'eps': basepath + '.eps', 'pdf': basepath + '.pdf',
+            'svg_width': None, 'svg_height': None}
+    ## save eps and additional formats, see <http://root.cern.ch/root/html/TPad.html#TPad:SaveAs>
+    canvas.SaveAs(info['eps'])
+    canvas.SaveAs(info['pdf'])
+    ## save img
+    img = basepath + '.' + img_format
+    if img_format == 'gif':
+        save_image(canvas, img, opts['img_height'])
+    else: 
+        canvas.SaveAs(img)
+    if img_format == 'svg':
+        ## retrieve svg width, heigth (smaller than canvas)
+        with open(img, "r") as svg:
+            for line in svg:
+                if line.startswith("<svg"):
+                    info['svg_width']  = int(1.05*float(re.search(r'width="(\d*)"' , line).group(1)))
+                    info['svg_height'] = int(1.15*float(re.search(r'height="(\d*)"', line).group(1)))
+                    break
+    info['img'] = img
+    ## save thumb
+    thumb = basepath + ('.thumb.gif' if img_format == 'gif' else '.thumb.png')
+    save_image(canvas, thumb, opts['thumb_height'])
+    info['thumb'] = thumb
+    if not quiet:
+        print('  Created %s' % thumb)
+    ## get stats
+    info['stats'] = None
+    stats = get_canvas_stats(canvas)
+    if stats:
+        clean_stats_names(stats)
+        tab = convert_stats_to_table(stats)
+        info['stats'] = convert_table_to_html(tab)
+    return info
+
+#__________________________________________________________________________
+def save_image(canvas, name, height):
+    """Save *canvas* as image *name* scaled to *height* pixels (via TImage)"""
+    img = ROOT.TImage.Create()
+    img.FromPad(canvas)
+    width = max(1, int(round(img.GetWidth() * float(height) / max(1, img.GetHeight()))))
+    img.Scale(width, height)
+    img.WriteImage(name)
+
+#__________________________________________________________________________
+def get_key_hash(f, key, opts=None):
+    """Return content hash of the object stored under *key*
+    
+    The hash is taken over the (compressed) object record read from 
+    the raw file *f*, excluding the key header (which contains the 
+    write time), and the image options *opts*. 
+    """
+    hash_obj = hashlib.md5()
+    f.seek(key.GetSeekKey() + key.GetKeylen())
+    hash_obj.update(f.read(key.GetNbytes() - key.GetKeylen()))
+    hash_obj.update(json.dumps(opts, sort_keys=True).encode())
+    return hash_obj.hexdigest()
+
 #__________________________________________________________________________
 def get_canvas_stats(canvas):
     prims = [ p for p in canvas.GetListOfPrimitives() ]
@@ -620,7 +741,7 @@ def clean_stats_names(names_stats):
     if name.count(sep):
         postfix = name.split(sep)[-1]
     if postfix:
-        for i in xrange(len(names_stats)):
+        for i in range(len(names_stats)):
             name, stats = names_stats[i]
             if name.endswith(sep+postfix):
                 name = '__'.join(name.split(sep)[0:-1])
@@ -630,7 +751,7 @@ def clean_stats_names(names_stats):
 def convert_stats_to_table(names_stats):
     ## hack, need to come up with a way to determine which stats to expect,
     ## and how to organize the table(s)
-    if names_stats[0][1].has_key('rms_x'): # TH2
+    if 'rms_x' in names_stats[0][1]: # TH2
         top_row = ['name', 'entries', 'int', 'err', 'mean_x', 'rms_x', 'mean_y', 'rms_y']
     else:
         top_row = ['name', 'entries', 'int', 'err', 'mean', 'rms', 'under', 'over']
@@ -684,17 +805,16 @@ def walk(top, topdown=True):
     """
 # - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     assert isinstance(top, ROOT.TDirectory)
-    names = [k.GetName() for k in top.GetListOfKeys()]
     dirpath = top.GetPath()
     dirnames = []
     filenames = []
-    ## filter names for directories
-    for k in names:
-        d = top.Get(k)
-        if isinstance(d, ROOT.TDirectory):
-            dirnames.append(k)
+    ## filter names for directories (from key class, without reading objects)
+    for k in top.GetListOfKeys():
+        cl = ROOT.TClass.GetClass(k.GetClassName())
+        if cl and cl.InheritsFrom("TDirectory"):
+            dirnames.append(k.GetName())
         else:
-            filenames.append(k)
+            filenames.append(k.GetName())
     ## sort
     dirnames.sort()
     filenames.sort()
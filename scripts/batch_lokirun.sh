@@ -0,0 +1,50 @@
+#!/usr/bin/env bash
+#PBS -N loki-run
+#PBS -l mem=4g
+## Queues: vshort (10min), short (2h 30min), medium (24h), long (1 week)
+#PBS -q medium
+#PBS -j oe
+##===============================================
+## Job script for the loki executor backends
+## (see loki/core/executor.py)
+##
+## Runs the selectors of a single job with the
+## standalone executor (build/lokirun). Used as
+## array job on PBS/HTCondor, and as subprocess
+## by the local executor.
+##
+## Environment:
+##   LOKIRUN  : path of lokirun
+##   JOBSPEC  : job spec (all selectors of the batch)
+##   JOBINDEX : selector indices, one line per job
+##   JOBDIR   : shared dir for the job markers
+##   LOKISETUP: source the loki setup (batch nodes)
+##
+## Usage:
+##   batch_lokirun.sh [JOBID]
+## JOBID (0-based) defaults to PBS_ARRAYID.
+##===============================================
+
+# determine job id for array job
+JOBID=${1:-${PBS_ARRAYID}}
+echo "JOBSPEC: ${JOBSPEC}"
+echo "JOBID  : ${JOBID}"
+
+# setup
+if [ ! -z ${LOKISETUP} ]; then
+    echo "LOKIDIR: ${LOKIDIR}"
+    source /etc/profile
+    source ${LOKIDIR}/setup.sh
+fi
+
+# execute (stats to .out, exit status to .done once finished)
+PREFIX="${JOBDIR}/job_${JOBID}"
+INDICES=`sed -n "$((JOBID+1))p" ${JOBINDEX}`
+echo "INDICES: ${INDICES}"
+touch ${PREFIX}.start
+"${LOKIRUN}" "${JOBSPEC}" ${INDICES} > ${PREFIX}.out
+STATUS=$?
+echo ${STATUS} > ${PREFIX}.done.tmp && mv ${PREFIX}.done.tmp ${PREFIX}.done
+
+echo "Done"
+exit ${STATUS}
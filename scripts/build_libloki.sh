@@ -0,0 +1,47 @@
+#!/usr/bin/env bash
+##===============================================
+## Build script for libLoki, the prebuilt shared
+## library of the loki cpp classes (LokiExpr,
+## LokiHist1D/2D/3D, LokiEff, LokiNtup and
+## LokiSelector) with their ROOT dictionary
+##
+## If the library is present and up to date with
+## the sources, loki.core.process.load_cpp_classes
+## loads it directly instead of compiling the
+## classes with ACLiC in every process.
+##
+## Optionally an -march variant can be built,
+## which is used if LOKI_MARCH is set to the same
+## value at runtime (eg. LOKI_MARCH=native).
+##
+## Output:
+##   build[/march-MARCH]/libLoki.so
+##   build[/march-MARCH]/libLoki.rootmap
+##   build[/march-MARCH]/libLoki_rdict.pcm
+##
+## Usage (from anywhere):
+##   scripts/build_libloki.sh [MARCH]
+##===============================================
+set -e
+PROJ="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+SRC="${PROJ}/src"
+MARCH="$1"
+BUILD="${PROJ}/build${MARCH:+/march-${MARCH}}"
+CXX="${CXX:-$(root-config --cxx)}"
+FLAGS="-O3 -fPIC${MARCH:+ -march=${MARCH}}"
+# build in tmp dir and move into place, so that concurrent
+# loads never see a partially written library
+mkdir -p "${BUILD}"
+TMP="$(mktemp -d "${BUILD}/.tmp.XXXXXX")"
+trap 'rm -rf "${TMP}"' EXIT
+# dictionary and rootmap
+(cd "${TMP}" && rootcling -f LokiDict.cxx -s libLoki.so \
+    -rml libLoki.so -rmf libLoki.rootmap -I"${SRC}" \
+    LokiHist.h LokiSelector.h "${SRC}/LokiLinkDef.h")
+# library
+${CXX} ${FLAGS} -shared $(root-config --cflags) -I"${SRC}" -o "${TMP}/libLoki.so" \
+    "${SRC}/LokiExpr.C" "${SRC}/LokiHist.C" "${SRC}/LokiSelector.C" \
+    "${TMP}/LokiDict.cxx" $(root-config --libs) -lTreePlayer
+mv -f "${TMP}/libLoki_rdict.pcm" "${TMP}/libLoki.rootmap" "${BUILD}/"
+mv -f "${TMP}/libLoki.so" "${BUILD}/"
+echo "Built ${BUILD}/libLoki.so"
@@ -0,0 +1,29 @@
+#!/usr/bin/env bash
+##===============================================
+## Build script for lokirun, the standalone
+## batch executor for loki job specs
+## (see src/lokirun.cxx and src/LokiJob.h)
+##
+## Builds libLoki (see build_libloki.sh), then
+## compiles lokirun and links it against libLoki
+## and ROOT (requires root-config).
+##
+## Output:
+##   build/lokirun
+##
+## Usage (from anywhere):
+##   scripts/build_lokirun.sh [CXX flags...]
+##===============================================
+set -e
+PROJ="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+SRC="${PROJ}/src"
+BUILD="${PROJ}/build"
+CXX="${CXX:-$(root-config --cxx)}"
+# library (with dictionary)
+"${PROJ}/scripts/build_libloki.sh"
+# executable
+${CXX} -O2 "$@" $(root-config --cflags) -I"${SRC}" -o "${BUILD}/lokirun" \
+    "${SRC}/lokirun.cxx" "${SRC}/LokiJob.C" \
+    -L"${BUILD}" -lLoki -Wl,-rpath,"${BUILD}" \
+    $(root-config --libs) -lTreePlayer
+echo "Built ${BUILD}/lokirun"
@@ -0,0 +1,278 @@
+/**
+ * LokiExpr.h
+ * ~~~~~~~~~~
+ * Implements LokiColumn, LokiColumnCache,
+ * LokiJaggedCache and LokiProgram.
+ *
+ * LokiColumn holds the decoded content of a single
+ * basket of a flat scalar branch. It is filled via
+ * basket-level bulk reads (TBranch::GetBulkRead,
+ * ROOT >= 6.20) and used by the LokiSelector
+ * bulk-read fast path. Jagged columns (std::vector
+ * branches of basic type, eg. the TauJets aux
+ * variables) and Float16_t columns (reduced-precision
+ * flat ntuples) can't be bulk read, since ROOT can't
+ * deserialise them in bulk: they are only filled from
+ * the column cache (LokiJaggedCache, LokiColumnCache).
+ * Float16_t values are cached as 4-byte floats.
+ *
+ * LokiColumnCache is an optional local cache of the
+ * decoded values of a column, stored in the branch's
+ * native type in a memory-mapped file:
+ *
+ *   header (magic, version, type, type size, tree
+ *   entries, cached entries), followed by the values
+ *   of entries [0, cached entries)
+ *
+ * Entries covered by the cache are read from the
+ * mapped file (ie. from the page cache once warm) in
+ * chunks of kChunk entries, skipping decompression and
+ * deserialisation. If the cache doesn't cover the whole
+ * tree, the column values read past the cached
+ * entries are written to a new cache file (seeded with
+ * the cached values) as long as they continue the
+ * cached prefix (eg. a run over a larger event
+ * fraction), which replaces the old file on Commit. Files are
+ * replaced atomically (rename), so concurrent readers
+ * and writers are safe. The caller is responsible for
+ * keying the cache path by file identity.
+ *
+ * LokiJaggedCache caches a jagged column in two such
+ * files: <name>.off holds the end offset (Long64_t) of
+ * the values of each entry, <name>.val the values of
+ * all entries (without entry limit). The values file
+ * is committed first, so the offsets never point past
+ * the cached values.
+ *
+ * LokiProgram is a small bytecode compiler and
+ * vectorised VM for the subset of the TTree::Draw
+ * language used by the loki vars (Var, Expr, Cuts,
+ * Weights): numeric constants, branch references,
+ * arithmetic (+ - * /), comparisons, logical
+ * operators (&& || !) and the functions abs/fabs,
+ * sqrt, log, log10, exp, sin, cos, pow, min and max
+ * (also with TMath:: prefix).
+ *
+ * Each expression is compiled into a sequence of ops
+ * on registers, where each register holds the values
+ * of a whole block of entries. The ops are evaluated
+ * as tight loops over the block, which the compiler
+ * vectorises. All expressions of a selector are
+ * compiled into the same program, and identical
+ * subexpressions are only compiled once (common
+ * subexpression elimination via hash-consing of the
+ * ops), eg. a selection shared by many hists is
+ * evaluated once per block. Constant subexpressions
+ * are folded at compile time.
+ *
+ * As in TTreeFormula, division by zero and the log of
+ * non-positive numbers return 0, and sqrt takes the
+ * absolute value of its argument.
+ *
+ * Columns that can only be read from the cache
+ * (jagged or Float16_t, see LokiColumn) are only
+ * accepted if enabled in the LokiProgram constructor.
+ * With jagged columns, each entry gives one row
+ * per instance, ie. the smallest size of its jagged
+ * columns (as TTreeFormulaManager), and scalar columns
+ * are broadcast to all rows of the entry.
+ *
+ * Expressions outside the subset (eg. array indices,
+ * aliases, unknown functions or non-scalar branches)
+ * fail to compile, in which case the selector falls
+ * back to TTreeFormula.
+ *
+ * Author    : "Will Davey"
+ * Email     : "will.davey@cern.ch"
+ * Created   : 2017-02-22
+ * Copyright : "Copyright 2016 Will Davey"
+ * License   : "GPL http://www.gnu.org/licenses/gpl.html"
+ */
+#ifndef LokiExpr_h
+#define LokiExpr_h
+
+#include <TTree.h>
+#include <TBranch.h>
+#include <TBufferFile.h>
+#include <TDataType.h>
+#include <RVersion.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// basket-level bulk reads (TBranch::GetBulkRead)
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,20,0)
+#define LOKI_BULK_READ
+#endif
+
+class LokiColumnCache {
+public:
+    static const UInt_t kMagic = 0x4c4f4b43; // "LOKC"
+    static const UInt_t kVersion = 1;
+    static const Long64_t kChunk = 65536;  // entries per read
+
+    struct Header {
+      UInt_t magic;
+      UInt_t version;
+      Int_t type;      // EDataType
+      Int_t size;      // bytes per value
+      Long64_t ntree;  // entries in tree
+      Long64_t n;      // cached entries
+    };
+
+    LokiColumnCache(const std::string& fname, EDataType type, Long64_t ntree);
+    virtual ~LokiColumnCache();
+
+    static size_t TypeSize(EDataType type);
+    bool Open();
+    void Close();
+    Long64_t GetEntries() const { return n; }
+    const char* Values() const { return map + sizeof(Header); }
+    bool Decode(Long64_t start, Long64_t m, double* out) const;
+    bool Read(Long64_t entry, std::vector<double>& out, Long64_t& start, Long64_t& end);
+    void Write(const double* data, Long64_t start, Long64_t end);
+    bool Commit();
+    void Discard();
+
+public :
+   std::string fname;
+   EDataType type;
+   Long64_t ntree;          // entries in tree (negative: no limit)
+   Long64_t n;              // cached entries (mapped file)
+   Long64_t nread;          // entries read from the cache
+   const char* map;         // mapped file (null: not cached)
+   size_t mapsize;
+   std::string ftmp;        // file being written
+   std::ofstream out;
+   Long64_t nwritten;       // entries written to *ftmp*
+   bool broken;             // written entries not contiguous
+   std::vector<char> encoded;
+
+};
+
+class LokiJaggedCache {
+public:
+    LokiJaggedCache(const std::string& fname, EDataType type, Long64_t ntree);
+    virtual ~LokiJaggedCache(){};
+
+    Long64_t GetEntries() const { return n; }
+    bool Read(Long64_t entry, std::vector<double>& out, std::vector<Long64_t>& offs, 
+              Long64_t& start, Long64_t& end);
+    void Write(const double* data, const Long64_t* offs, Long64_t start, Long64_t end);
+    bool Commit();
+
+private:
+    Long64_t End(Long64_t entry) const 
+    { return entry < 0 ? 0 : reinterpret_cast<const Long64_t*>(offsets.Values())[entry]; }
+    void Validate();
+
+public :
+   LokiColumnCache offsets; // end offset of the values of each entry
+   LokiColumnCache values;  // values of all entries
+   Long64_t n;              // cached entries
+   Long64_t nread;          // entries read from the cache
+   std::vector<double> ends; // new end offsets (see Write)
+
+};
+
+class LokiColumn {
+public:
+    LokiColumn(TBranch* branch, EDataType type, bool jagged=false);
+    virtual ~LokiColumn(){};
+
+    static LokiColumn* Create(TBranch* branch);
+    static LokiColumn* CreateCached(TBranch* branch);
+    bool Load(Long64_t entry);
+    bool Read(Long64_t entry, TBufferFile& b, std::vector<double>& out,
+              Long64_t& start, Long64_t& end) const;
+    bool ReadBasket(Long64_t entry, TBufferFile& b, std::vector<double>& out,
+                    Long64_t& start, Long64_t& end) const;
+    bool Contains(Long64_t entry) const { return entry >= first and entry < last; }
+    const double* Data(Long64_t entry) const 
+    { return data.data() + (jagged ? offsets[entry-first] : entry-first); }
+    Long64_t Size(Long64_t entry) const 
+    { return jagged ? offsets[entry-first+1] - offsets[entry-first] : 1; }
+    void SetCache(LokiColumnCache* c) { cache.reset(c); }
+
+public :
+   TBranch* branch;
+   std::string name;        // name in the expressions
+   EDataType type;          // (value) type
+   bool jagged;             // one value per instance (std::vector)
+   bool bulk;               // baskets can be bulk read (otherwise cache only)
+   Long64_t first;          // first entry in basket
+   Long64_t last;           // last entry in basket (exclusive)
+   std::vector<double> data; // decoded values
+   std::vector<Long64_t> offsets; // begin offset of each entry in *data* (jagged)
+   TBufferFile buf;         // serialized basket buffer
+   std::unique_ptr<LokiColumnCache> cache; // decoded column cache (optional)
+   std::unique_ptr<LokiJaggedCache> jcache; // jagged column cache (jagged only)
+
+};
+
+class LokiProgram {
+public:
+    enum EOp { kLoad, kConst,
+               kAdd, kSub, kMul, kDiv,
+               kLT, kLE, kGT, kGE, kEQ, kNE, kAnd, kOr,
+               kNot, kNeg, kAbs, kSqrt, kLog, kLog10, kExp, kSin, kCos,
+               kPow, kMin, kMax };
+
+    struct Op {
+      EOp op;
+      int a;     // first operand (register)
+      int b;     // second operand (register)
+      double c;  // constant value or column index
+    };
+
+    LokiProgram(TTree* tree, bool cached=false);
+    virtual ~LokiProgram();
+
+    int Compile(const std::string& expr);
+    Long64_t Eval(Long64_t first, Long64_t last);
+    bool IsJagged() const { return fnjagged > 0; }
+    bool NeedsCache() const { return fncached > 0; }
+    const double* Output(int reg) const { return fout[reg]; }
+    const std::vector<LokiColumn*>& GetColumns() const { return fcols; }
+    size_t GetNops() const { return fops.size(); }
+
+private:
+    int AddOp(EOp op, int a=-1, int b=-1, double c=0.);
+    int AddColumn(const std::string& name);
+    static double Apply(EOp op, double x, double y);
+    size_t Expand(Long64_t first, Long64_t last);
+
+    // recursive-descent parser (lowest to highest precedence)
+    int ParseOr();
+    int ParseAnd();
+    int ParseEquality();
+    int ParseRelational();
+    int ParseAdditive();
+    int ParseMultiplicative();
+    int ParseUnary();
+    int ParsePrimary();
+    int ParseCall(const std::string& name);
+    bool Match(const char* token);
+    void SkipSpace();
+
+    TTree* fTree;
+    bool fcached;            // allow cache-only columns
+    size_t fncached;         // number of cache-only columns
+    size_t fnjagged;         // number of jagged columns
+    std::vector<std::vector<double> > fexp; // column values expanded to rows (jagged)
+    std::vector<Long64_t> fcount; // rows per entry (jagged)
+    std::vector<Op> fops;
+    std::map<std::tuple<int,int,int,double>, int> fcse;
+    std::vector<LokiColumn*> fcols;
+    std::map<std::string, int> fcolidx;
+    std::vector<std::vector<double> > fregs;
+    std::vector<const double*> fout;
+    std::string fexpr;
+    size_t fpos;
+
+};
+
+#endif
@@ -1,7 +1,8 @@
 /**
  * LokiHist.h
  * ~~~~~~~~~~
- * Implements LokiHist1D, LokiHist2D and LokiHist3D.
+ * Implements LokiHist1D, LokiHist2D, LokiHist3D, LokiEff
+ * and LokiNtup.
  *
  * These classes contain the basic attributes needed
  * to define 1D, 2D and 3D histograms, using TTree::Draw
@@ -21,6 +22,43 @@
  * the first 'n' values returned by the underlying
  * TTreeFormula
  *
+ * In the LokiSelector bulk-read fast path the
+ * FillBlock(prog, n) functions fill the histogram
+ * for a block of 'n' entries directly from the
+ * output registers (ix, iy, iz, isel, iwei) of the
+ * LokiProgram, bypassing the TTreeFormula.
+ *
+ * LokiEff is a native efficiency accumulator, which
+ * fills the numerator (pass) and denominator (total)
+ * 1D histograms of an efficiency profile together.
+ * The axis variable and weight are evaluated once
+ * per instance, the total hist is filled if the
+ * total selection passes and the pass hist if both
+ * the total and pass selections pass (so the pass
+ * selection is only evaluated for instances in the
+ * denominator). Both hists store the sum of weights
+ * squared (Sumw2), as needed for the binomial
+ * errors of weighted efficiencies. They are written
+ * to the output file with the names 'hash_pass' and
+ * 'hash_total', ie. exactly as two separate LokiHist1D.
+ *
+ * LokiNtup is a flat-ntuple output sink: for each
+ * instance passing its selection it writes the values
+ * of a set of variables, and a 'weight' branch (weight
+ * expression times a constant 'scale', or 1), as one
+ * entry of a flat output tree, equivalent to the
+ * flatten_ntup output. It is filled in the same event
+ * loop as the hists, sharing their formulae (and their
+ * LokiProgram registers in the bulk-read path). The
+ * branches are booked as Int_t for integer expressions
+ * and Float_t otherwise, or with the ROOT leaf type
+ * set per variable via SetTypes (eg. "f[0,100,12]" for
+ * a reduced-precision Float16_t). Unlike the hists,
+ * the tree is written directly to its own output file
+ * ('fname'), which is opened in Init() and closed in
+ * Finish(), with the compression settings given via
+ * SetCompression (default: ROOT default).
+ *
  * Author    : "Will Davey"
  * Email     : "will.davey@cern.ch"
  * Created   : 2017-02-22
@@ -34,7 +72,10 @@
 #include <TH1.h>
 #include <TH2.h>
 #include <TH3.h>
+#include <TFile.h>
+#include <TTree.h>
 #include <TTreeFormula.h>
+#include "LokiExpr.h"
 #include <vector>
 #include <string>
 
@@ -51,6 +92,7 @@ public:
 
     void Init();
     void Fill(size_t n);
+    void FillBlock(const LokiProgram* prog, Long64_t n);
 
 public :
    // config
@@ -65,6 +107,9 @@ public :
    TTreeFormula* fx;
    TTreeFormula* fsel;
    TTreeFormula* fwei;
+   int ix; //!
+   int isel; //!
+   int iwei; //!
 
    ClassDef(LokiHist1D,1);
 
@@ -84,6 +129,7 @@ public:
 
     void Init();
     void Fill(size_t n);
+    void FillBlock(const LokiProgram* prog, Long64_t n);
 
 public :
    // config
@@ -101,6 +147,10 @@ public :
    TTreeFormula* fy;
    TTreeFormula* fsel;
    TTreeFormula* fwei;
+   int ix; //!
+   int iy; //!
+   int isel; //!
+   int iwei; //!
 
    ClassDef(LokiHist2D,1);
 
@@ -122,6 +172,7 @@ public:
 
     void Init();
     void Fill(size_t n);
+    void FillBlock(const LokiProgram* prog, Long64_t n);
 
 public :
    // config
@@ -142,9 +193,106 @@ public :
    TTreeFormula* fz;
    TTreeFormula* fsel;
    TTreeFormula* fwei;
+   int ix; //!
+   int iy; //!
+   int iz; //!
+   int isel; //!
+   int iwei; //!
 
    ClassDef(LokiHist3D,1);
 
 };
 
+class LokiEff : public TObject {
+public: 
+    LokiEff();
+    LokiEff(std::string hash_pass, 
+            std::string hash_total, 
+            std::string xvar, 
+            std::vector<float> xbins,
+            std::string sel_pass = "",
+            std::string sel_total = "",
+            std::string wei = "");
+    virtual ~LokiEff(){};
+
+    void Init();
+    void Fill(size_t n);
+    void FillBlock(const LokiProgram* prog, Long64_t n);
+
+public :
+   // config
+   std::string xvar; 
+   std::string sel_pass;
+   std::string sel_total;
+   std::string wei;
+   std::string hash_pass;
+   std::string hash_total;
+   std::vector<float> xbins;
+
+   // members
+   TH1* hpass;
+   TH1* htotal;
+   TTreeFormula* fx;
+   TTreeFormula* fpass;
+   TTreeFormula* ftotal;
+   TTreeFormula* fwei;
+   int ix; //!
+   int ipass; //!
+   int itotal; //!
+   int iwei; //!
+
+   ClassDef(LokiEff,1);
+
+};
+
+class LokiNtup : public TObject {
+public: 
+    LokiNtup();
+    LokiNtup(std::string fname, 
+             std::string tname, 
+             std::vector<std::string> names,
+             std::vector<std::string> vars,
+             std::string sel = "",
+             std::string wei = "",
+             double scale = 1.0);
+    virtual ~LokiNtup(){ Finish(); };
+
+    void Init();
+    void Book();
+    void Fill(size_t n);
+    void FillBlock(const LokiProgram* prog, Long64_t n);
+    void Finish();
+    void SetTypes(const std::vector<std::string>& t) { types = t; }
+    void SetCompression(int settings) { compress = settings; }
+
+public :
+   // config
+   std::string fname; 
+   std::string tname; 
+   std::vector<std::string> names;
+   std::vector<std::string> vars;
+   std::string sel;
+   std::string wei;
+   double scale;
+   std::vector<std::string> types; // leaf type of non-integer vars (empty: "F")
+   int compress;                    // compression settings (-1: default)
+
+   // members
+   TFile* f; //!
+   TTree* t; //!
+   std::vector<TTreeFormula*> fvars; //!
+   TTreeFormula* fsel; //!
+   TTreeFormula* fwei; //!
+   std::vector<int> ivars; //!
+   int isel; //!
+   int iwei; //!
+   std::vector<bool> isint; //!integer branch
+   std::vector<Float_t> fbuf; //!float branch buffers
+   std::vector<Int_t> ibuf; //!int branch buffers
+   Float_t weight; //!
+
+   ClassDef(LokiNtup,2);
+
+};
+
 #endif
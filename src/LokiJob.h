@@ -0,0 +1,127 @@
+/**
+ * LokiJob.h
+ * ~~~~~~~~~
+ * Implements LokiJson and LokiJob.
+ *
+ * LokiJob runs a LokiSelector from a serialised
+ * selector configuration (job spec), so that the
+ * processing can be done without python, eg. by the
+ * standalone lokirun executable on batch worker nodes.
+ * The job specs are written by the python
+ * SelectorCfg (see loki.core.process.write_job_spec)
+ * in JSON format:
+ *
+ *   {"version": 1,
+ *    "selectors": [
+ *      {"fin": "in.root", "fout": "out.root",
+ *       "tname": "CollectionTree",
+ *       "nevents": 1000, "first": 0, "pipeline": false,
+ *       "colcache": "/path/to/column/cache",
+ *       "hists": [{"hash": "...",
+ *                  "xexpr": "...", "xbins": [0, 1, 2],
+ *                  "yexpr": null, "ybins": null,
+ *                  "zexpr": null, "zbins": null,
+ *                  "sexpr": "...", "wexpr": "..."}, ...],
+ *       "effs": [["<pass hash>", "<total hash>"], ...],
+ *       "ntups": [{"fout": "ntup.root", "tname": "...",
+ *                  "names": ["pt", ...], "exprs": ["...", ...],
+ *                  "sexpr": "...", "wexpr": null,
+ *                  "scale": 1.0, "types": ["F", ...],
+ *                  "compress": 404}, ...]
+ *      }, ...]}
+ *
+ * The hists are configured as LokiHist1D/2D/3D, depending
+ * on which axis expressions are given. Hists listed in
+ * pairs under "effs" (the pass and total components of
+ * an efficiency profile) are instead filled together by a
+ * single LokiEff. Entries under "ntups" (optional) are
+ * written as flat ntuples by a LokiNtup in the same
+ * pass, with optional per-variable leaf "types" and
+ * "compress" settings (see LokiNtup). A null
+ * "nevents" processes all entries.
+ * If "colcache" is given (optional), the decoded
+ * columns are cached in that dir (see
+ * LokiSelector::SetColumnCache).
+ * Unknown keys are ignored.
+ *
+ * LokiJson is a minimal JSON reader (objects, arrays,
+ * strings, numbers, booleans and null), sufficient for
+ * the job specs.
+ *
+ * Author    : "Will Davey"
+ * Email     : "will.davey@cern.ch"
+ * Created   : 2017-02-22
+ * Copyright : "Copyright 2016 Will Davey"
+ * License   : "GPL http://www.gnu.org/licenses/gpl.html"
+ */
+#ifndef LokiJob_h
+#define LokiJob_h
+
+#include "LokiSelector.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class LokiJson {
+public:
+    enum EType { kNull, kBool, kNumber, kString, kArray, kObject };
+
+    LokiJson() : type(kNull), number(0.) {}
+
+    static bool Parse(const std::string& text, LokiJson& out, std::string& err);
+    static bool ReadFile(const std::string& fname, LokiJson& out, std::string& err);
+    static std::string Quote(const std::string& str);
+
+    bool IsNull() const { return type == kNull; }
+    size_t Size() const { return type == kArray ? array.size() : object.size(); }
+    const LokiJson& operator[](size_t i) const;
+    const LokiJson& operator[](const std::string& key) const;
+    std::string String(const std::string& def = "") const { return type == kString ? str : def; }
+    double Number(double def = 0.) const { return type == kNumber ? number : def; }
+    bool Bool(bool def = false) const { return type == kBool ? number != 0. : def; }
+    std::vector<float> Floats() const;
+    std::vector<std::string> Strings() const;
+
+public :
+   EType type;
+   double number;  // value of number (or bool)
+   std::string str;
+   std::vector<LokiJson> array;
+   std::map<std::string, LokiJson> object;
+
+};
+
+class LokiJob {
+public:
+    LokiJob();
+    virtual ~LokiJob() {}
+
+    static bool Read(const std::string& fname, std::vector<std::unique_ptr<LokiJob> >& jobs, 
+                     std::string& err);
+    bool Configure(const LokiJson& spec, std::string& err);
+    bool Run();
+    std::string GetStats() const;
+
+public :
+   // config
+   std::string fin;
+   std::string fout;
+   std::string tname;
+   Long64_t nevents;   // -1: all entries
+   Long64_t first;
+   bool pipeline;
+   std::string colcache;
+
+   // members
+   std::unique_ptr<LokiSelector> selector;
+   size_t nhists;
+
+   // stats
+   Long64_t nprocessed;
+   Long64_t bytes_read;
+   double real_time;
+
+};
+
+#endif
@@ -0,0 +1,25 @@
+/**
+ * LokiLinkDef.h
+ * ~~~~~~~~~~~~~
+ * Dictionary link definitions for the loki cpp classes,
+ * used when building them outside of ACLiC with rootcling
+ * (see scripts/build_libloki.sh).
+ *
+ * Author    : "Will Davey"
+ * Email     : "will.davey@cern.ch"
+ * Created   : 2017-02-22
+ * Copyright : "Copyright 2016 Will Davey"
+ * License   : "GPL http://www.gnu.org/licenses/gpl.html"
+ */
+#ifdef __CLING__
+#pragma link off all globals;
+#pragma link off all classes;
+#pragma link off all functions;
+
+#pragma link C++ class LokiHist1D+;
+#pragma link C++ class LokiHist2D+;
+#pragma link C++ class LokiHist3D+;
+#pragma link C++ class LokiEff+;
+#pragma link C++ class LokiNtup+;
+#pragma link C++ class LokiSelector+;
+#endif
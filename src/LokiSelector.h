@@ -7,7 +7,13 @@
  * from a single input file, filling a set of user
  * defined histograms. The histograms are added to
  * the selector via the AddHist function in the
- * form of the LokiHist1D/2D/3D classes. The
+ * form of the LokiHist1D/2D/3D classes.
+ * Efficiency profiles can be added via the AddEff
+ * function in the form of the LokiEff class, which
+ * fills the pass and total hists in one go. Flat
+ * ntuples can be written in the same pass via the
+ * AddNtup function in the form of the LokiNtup class,
+ * sharing the formulae with the hists. The
  * histograms are saved to an output file
  * (*fout_name*) whose name is passed to the
  * selector constructor.
@@ -44,6 +50,96 @@
  * Does not work with PROOF, not exactly sure why,
  * but returns status code -1.
  *
+ * Bulk booking: instead of constructing and adding
+ * each LokiHist individually (one interpreter crossing
+ * per object when driven from python), the whole
+ * booking table can be passed to Book() in one call,
+ * as three packed buffers:
+ *
+ *   strs:  all strings (hashes, expressions), separated
+ *          by '\0', referred to by their index
+ *   table: kBookFields ints per hist (see EBookField),
+ *          string fields are indices into strs (-1: none)
+ *          and bin-edge fields are offsets/lengths into
+ *          edges
+ *   edges: the concatenated bin edges
+ *
+ * Rows of type kBookEff create a LokiEff (pass hash
+ * and selection in the first hash/sel fields, total
+ * hash and selection in the second ones).
+ *
+ * Memory: the selector owns everything it allocates
+ * (formulae, formula manager, bulk-read program,
+ * pipeline, input list and the objects created by Book)
+ * via RAII members, so repeated Init() calls and
+ * long-lived worker processes don't leak. Re-initialising
+ * with the same tree reuses the existing formulae and
+ * program. The resident set size of the process is
+ * sampled at the start, every kMonInterval entries and
+ * at the end of the loop (GetStartRSS, GetRSS and
+ * GetPeakRSS, in bytes), and published in the monitor
+ * slot (kMonRSS).
+ *
+ * Live progress monitoring: if a monitor slot is
+ * provided via SetMonitor (address of a block of
+ * kMonFields doubles, eg. in shared memory), the
+ * selector publishes the number of processed
+ * entries, the bytes read from the input file and
+ * the time of the last update every kMonInterval
+ * entries. This allows the driver to report live
+ * throughput and detect stalled workers.
+ *
+ * Bulk-read fast path: if every expression can be
+ * compiled into a LokiProgram (see LokiExpr.h), ie.
+ * it only uses the supported subset of the TTree::Draw
+ * language on scalar branches of basic type (eg. flat
+ * ntuples written by flatten_ntup), the selector
+ * skips the per-entry TTreeFormula evaluation.
+ * Instead it decodes whole baskets into LokiColumn
+ * arrays via TBranch::GetBulkRead, evaluates the
+ * program over blocks of entries and fills the hists
+ * from the program outputs (see FillBlock). The fast path requires
+ * ROOT >= 6.20 and can be switched off via
+ * SetBulkRead(false). Otherwise, or if a basket can't
+ * be read in bulk, the standard path is used.
+ *
+ * Column cache (SetColumnCache(dir)): the decoded
+ * values of each column are cached in a memory-mapped
+ * file <dir>/<branch>.col in the branch's native type
+ * (see LokiColumnCache), so that later runs over the
+ * same file read them from the page cache rather than
+ * decompressing the baskets. Jagged branches
+ * (std::vector of basic type, eg. TauJets variables)
+ * are cached in <dir>/<branch>.off and .val (see
+ * LokiJaggedCache) and then read by the bulk-read
+ * path as well. They, and Float16_t branches, can't
+ * be bulk read from the file, so a run that reaches
+ * an uncached entry of such a branch falls
+ * back to the TTreeFormula path and records the
+ * column values there (see StartRecording). The cache
+ * is filled from runs that start at entry 0 and
+ * committed at the end of the loop. The number of
+ * values read from the cache is available via
+ * GetCacheReads. The caller must key *dir* by file
+ * identity (eg. path and modification time) and tree.
+ * Programs with such columns are not pipelined.
+ *
+ * Pipelined mode (SetPipeline(true), bulk-read fast
+ * path only): a helper I/O thread reads and
+ * decompresses the baskets of cluster N+1 into a
+ * LokiBlock while the main thread fills the hists
+ * from cluster N. The two stages are connected by a
+ * bounded single-producer/single-consumer ring of
+ * kPipeDepth blocks, whose buffers are swapped into
+ * the columns rather than copied. Each stage blocks
+ * on a condition variable while the ring is full or
+ * empty. The I/O thread reads from its own copy of
+ * the input file and tree (opened in StartPipeline),
+ * so it never shares a TFile, TTree or TTreeCache
+ * with the main thread. Its bytes read are passed
+ * back with each block for the monitor. The
+ * TTreeFormula path is not pipelined.
+ *
  *
  * Author    : "Will Davey"
  * Email     : "will.davey@cern.ch"
@@ -68,24 +164,98 @@
 #include <TSelector.h>
 #include <TTreeFormula.h>
 #include <TTreeFormulaManager.h>
+#include <TLeaf.h>
+#include <TSystem.h>
+#include <TTimeStamp.h>
 #include "LokiHist.h"
+#include <algorithm>
 #include <vector>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// decoded values of all columns for a range of entries
+struct LokiBlock {
+  Long64_t first = 0;
+  Long64_t last = 0;
+  bool ok = false;  // false: read failure or end of tree
+  Long64_t bytes = 0; // bytes read from file for this block
+  std::vector<std::vector<double> > data;
+};
+
+// column cache filled on the TTreeFormula path (see StartRecording)
+struct LokiColumnRecord {
+  std::unique_ptr<TTreeFormula> f;
+  std::unique_ptr<LokiColumnCache> cache;  // scalar column
+  std::unique_ptr<LokiJaggedCache> jcache; // jagged column
+  std::vector<double> values;
+};
+
+// bounded single-producer/single-consumer ring of blocks (the 
+// producer waits while full, the consumer while empty)
+class LokiBlockQueue {
+public:
+  LokiBlockQueue(size_t n) : slots(n) {}
+  // producer: wait for next free slot (null if stopped), Push to publish
+  LokiBlock* Back() { 
+    std::unique_lock<std::mutex> lock(m);
+    cv.wait(lock, [this]{ return stop or head - tail < slots.size(); });
+    return stop ? 0 : &slots[head % slots.size()]; 
+  }
+  void Push() { Advance(head); }
+  // consumer: wait for oldest published slot, Pop to release
+  LokiBlock* Front() { 
+    std::unique_lock<std::mutex> lock(m);
+    cv.wait(lock, [this]{ return tail < head; });
+    return &slots[tail % slots.size()]; 
+  }
+  void Pop() { Advance(tail); }
+  // release a waiting producer
+  void Stop() { 
+    { std::lock_guard<std::mutex> lock(m); stop = true; }
+    cv.notify_all(); 
+  }
+private:
+  void Advance(size_t& i) { 
+    { std::lock_guard<std::mutex> lock(m); ++i; }
+    cv.notify_all(); 
+  }
+  std::vector<LokiBlock> slots;
+  std::mutex m;
+  std::condition_variable cv;
+  size_t head = 0;
+  size_t tail = 0;
+  bool stop = false;
+};
 
 
 
 class LokiSelector : public TSelector {
 public :
   TTree       *fChain = 0;  //!pointer to the analyzed TTree or TChain
-  TTreeFormulaManager* manager = 0; //!
+  std::unique_ptr<TTreeFormulaManager> manager; //!
+  TTree       *fTree = 0;   //!current tree (for monitoring)
   std::string fout_name;
 
+  // monitor slot layout
+  enum { kMonEntries=0, kMonBytes=1, kMonTime=2, kMonRSS=4, kMonFields=5 };
+  static const Long64_t kMonInterval = 1000;
+  static const size_t kPipeDepth = 3;
+  // bulk booking table layout (see Book)
+  enum EBookType { kBook1D=1, kBook2D=2, kBook3D=3, kBookEff=4 };
+  enum EBookField { kBookType=0, kBookHash, kBookHash2, kBookX, kBookY, kBookZ, 
+                    kBookSel, kBookSel2, kBookWei, kBookXEdges, kBookNX, 
+                    kBookYEdges, kBookNY, kBookZEdges, kBookNZ, kBookFields };
+
   LokiSelector(TTree * /*tree*/ =0)
     : fout_name("temp.root")
   { }
   LokiSelector(std::string fout_name)
     : fout_name(fout_name)
   { }
-  virtual ~LokiSelector() { }
+  virtual ~LokiSelector() { StopPipeline(); }
   virtual Int_t  Version() const { return 2; }
   virtual void   Begin(TTree *tree);
   virtual void   SlaveBegin(TTree *tree);
@@ -106,15 +276,68 @@ public :
   void AddHist(LokiHist1D* h); 
   void AddHist(LokiHist2D* h); 
   void AddHist(LokiHist3D* h); 
+  void AddEff(LokiEff* e); 
+  void AddNtup(LokiNtup* n); 
+  Long64_t Book(const char* strs, Long64_t nchars, const Int_t* table, Long64_t nrows, 
+                const Float_t* edges, Long64_t nedges);
+  void SetMonitor(ULong64_t address);
+  void UpdateMonitor();
+  void UpdateMemory();
+  Long64_t GetStartRSS() const { return fRSSStart; }
+  Long64_t GetRSS() const { return fRSS; }
+  Long64_t GetPeakRSS() const { return fRSSPeak; }
+  template<class T> T* Own(T* o) { fOwned.emplace_back(o); return o; }
+  void SetBulkRead(bool bulk) { fBulk = bulk; }
+  bool UsingBulkRead() const { return fUseBulk; }
+  void SetPipeline(bool pipeline) { fPipeline = pipeline; }
+  void SetColumnCache(const char* dir) { fColCache = dir ? dir : ""; }
+  Long64_t GetCacheReads() const { return fCacheReads; }
 
   std::vector<LokiHist1D*> hists1D; //!
   std::vector<LokiHist2D*> hists2D; //!
   std::vector<LokiHist3D*> hists3D; //!
-  std::map<std::string, TTreeFormula*> fmap; //!
+  std::vector<LokiEff*> effs; //!
+  std::vector<LokiNtup*> ntups; //!
+  std::map<std::string, std::unique_ptr<TTreeFormula> > fmap; //!
   bool fIsInit = false; //!
+  volatile double* fMon = 0; //!monitor slot (not owned)
+  Long64_t fNProcessed = 0; //!
+  bool fBulk = true; //!allow bulk-read fast path
+  bool fUseBulk = false; //!bulk-read fast path active
+  std::unique_ptr<LokiProgram> fprog; //!compiled expressions (bulk-read path)
+  Long64_t fBlockFirst = 0; //!first entry of pending block
+  Long64_t fBlockLast = 0; //!last entry of pending block (exclusive)
+  Long64_t fBlockEnd = 0; //!end of entry range loaded in all columns
+  bool fPipeline = false; //!use pipelined I/O (bulk-read path only)
+  std::unique_ptr<LokiBlockQueue> fqueue; //!
+  std::unique_ptr<std::thread> fio; //!I/O thread
+  std::unique_ptr<TFile> fioFile; //!input file opened by the I/O thread
+  std::vector<std::unique_ptr<LokiColumn> > fioCols; //!columns read by the I/O thread
+  Long64_t fIOBytes = 0; //!bytes read by the I/O thread
+  std::unique_ptr<TList> fInputList; //!owned input list (see Begin)
+  std::vector<std::unique_ptr<TObject> > fOwned; //!objects created by Book
+  Long64_t fRSSStart = 0; //!resident set size at start of loop [bytes]
+  Long64_t fRSS = 0; //!last sampled resident set size [bytes]
+  Long64_t fRSSPeak = 0; //!peak sampled resident set size [bytes]
+  std::string fColCache; //!column cache dir (empty: no cache)
+  Long64_t fCacheReads = 0; //!column values read from the cache
+  std::vector<LokiColumnRecord> fRecord; //!column caches filled on the TTreeFormula path
 
 private: 
   TTreeFormula* GetFormula(std::string name, TTree* tree);
+  void InitFormulae(TTree* tree);
+  bool CompileExpr(const std::string& expr, int& reg);
+  bool InitBulk();
+  void ClearBulk();
+  void CommitCache();
+  void StartRecording();
+  void Record(Long64_t entry);
+  bool LoadBlock(Long64_t entry);
+  bool NextBlock(Long64_t entry);
+  void FlushBlock();
+  bool StartPipeline(Long64_t entry);
+  void StopPipeline();
+  void RunPipeline(Long64_t entry, TTree* tree);
 
 
   ClassDef(LokiSelector,1);
@@ -129,15 +352,124 @@ TTreeFormula* LokiSelector::GetFormula(std::string name, TTree* tree)
 {
   if( name == "" ) return 0;
   // add to map if not present
-  if( fmap.find(name) == fmap.end() ){
-    fmap.insert(std::pair<std::string,TTreeFormula*>(
-      name, new TTreeFormula(name.c_str(), name.c_str(), tree)));
+  std::unique_ptr<TTreeFormula>& f = fmap[name];
+  if( not f ) f.reset(new TTreeFormula(name.c_str(), name.c_str(), tree));
+  return f.get();
+}
+bool LokiSelector::CompileExpr(const std::string& expr, int& reg)
+{
+  // Compile *expr* into the bulk-read program (empty: no expression)
+  reg = expr.empty() ? -1 : fprog->Compile(expr);
+  return expr.empty() or reg >= 0;
+}
+bool LokiSelector::InitBulk()
+{
+  // Compile all hist expressions into a LokiProgram, return false 
+  // if any expression is outside the supported subset or uses 
+  // non-scalar branches (jagged and Float16_t branches are allowed 
+  // with the column cache, see header)
+  ClearBulk();
+  if( hists1D.empty() and hists2D.empty() and hists3D.empty() and effs.empty() 
+      and ntups.empty() ) return false;
+  fprog.reset(new LokiProgram(fTree, not fColCache.empty()));
+  bool ok = true;
+  for ( LokiHist1D* h : hists1D ){
+    ok = ok and CompileExpr(h->xvar, h->ix) and CompileExpr(h->sel, h->isel)
+            and CompileExpr(h->wei, h->iwei);
+  }
+  for ( LokiHist2D* h : hists2D ){
+    ok = ok and CompileExpr(h->xvar, h->ix) and CompileExpr(h->yvar, h->iy) 
+            and CompileExpr(h->sel, h->isel) and CompileExpr(h->wei, h->iwei);
+  }
+  for ( LokiHist3D* h : hists3D ){
+    ok = ok and CompileExpr(h->xvar, h->ix) and CompileExpr(h->yvar, h->iy) 
+            and CompileExpr(h->zvar, h->iz) and CompileExpr(h->sel, h->isel) 
+            and CompileExpr(h->wei, h->iwei);
+  }
+  for ( LokiEff* e : effs ){
+    ok = ok and CompileExpr(e->xvar, e->ix) and CompileExpr(e->sel_pass, e->ipass) 
+            and CompileExpr(e->sel_total, e->itotal) and CompileExpr(e->wei, e->iwei);
+  }
+  for ( LokiNtup* n : ntups ){
+    for( size_t i=0; i<n->vars.size(); i++ ) ok = ok and CompileExpr(n->vars[i], n->ivars[i]);
+    ok = ok and CompileExpr(n->sel, n->isel) and CompileExpr(n->wei, n->iwei);
   }
-  // update tree if already exists
-  else{
-    //fmap[name]->SetTree(tree);
+  if( not ok or fprog->GetColumns().empty() ){
+    ClearBulk();
+    return false;
+  }
+  // attach column caches
+  if( not fColCache.empty() ){
+    gSystem->mkdir(fColCache.c_str(), kTRUE);
+    for( auto c : fprog->GetColumns() ){
+      std::string name = c->branch->GetName();
+      std::replace(name.begin(), name.end(), '/', '_');
+      std::string path = fColCache + "/" + name;
+      if( c->jagged ) c->jcache.reset(new LokiJaggedCache(path, c->type, fTree->GetEntries()));
+      else c->SetCache(new LokiColumnCache(path + ".col", c->type, fTree->GetEntries()));
+    }
+  }
+  return true;
+}
+void LokiSelector::CommitCache()
+{
+  // Commit the column caches (the I/O thread must be stopped)
+  for( auto& r : fRecord ){
+    if( r.cache ) r.cache->Commit();
+    if( r.jcache ) r.jcache->Commit();
+  }
+  fRecord.clear();
+  if( not fprog ) return;
+  for( auto c : fprog->GetColumns() ){
+    if( c->cache ){
+      c->cache->Commit();
+      fCacheReads += c->cache->nread;
+      c->cache->nread = 0;
+    }
+    if( c->jcache ){
+      c->jcache->Commit();
+      fCacheReads += c->jcache->nread;
+      c->jcache->nread = 0;
+    }
+  }
+}
+void LokiSelector::StartRecording()
+{
+  // Take over the column caches of the bulk-read program (before 
+  // falling back to the TTreeFormula path), to continue filling them 
+  // from a formula per column (see Record)
+  if( not fprog ) return;
+  for( auto c : fprog->GetColumns() ){
+    if( not c->cache and not c->jcache ) continue;
+    fCacheReads += c->cache ? c->cache->nread : c->jcache->nread;
+    LokiColumnRecord r;
+    r.f.reset(new TTreeFormula(c->name.c_str(), c->name.c_str(), fTree));
+    r.cache = std::move(c->cache);
+    r.jcache = std::move(c->jcache);
+    if( r.cache ) r.cache->nread = 0;
+    if( r.jcache ) r.jcache->nread = 0;
+    fRecord.push_back(std::move(r));
+  }
+}
+void LokiSelector::Record(Long64_t entry)
+{
+  // Write the column values of *entry* to the recorded caches
+  for( auto& r : fRecord ){
+    Int_t n = r.f->GetNdata();
+    r.values.resize(std::max(n, 1));
+    for( Int_t i=0; i<n; i++ ) r.values[i] = r.f->EvalInstance(i);
+    if( r.jcache ){
+      Long64_t offs[2] = {0, n};
+      r.jcache->Write(r.values.data(), offs, entry, entry + 1);
+    }
+    else if( n == 1 ) r.cache->Write(r.values.data(), entry, entry + 1);
   }
-  return fmap[name];
+}
+void LokiSelector::ClearBulk()
+{
+  StopPipeline();
+  fprog.reset();
+  fBlockFirst = fBlockLast = fBlockEnd = 0;
 }
 void LokiSelector::Init(TTree *tree)
 {
@@ -149,14 +481,51 @@ void LokiSelector::Init(TTree *tree)
   // (once per file to be processed).
 
   //if( fIsInit ) return;
-  for( auto kv : fmap ){
-	  delete kv.second;
+  // the formulae are bound to the tree: keep them if re-initialised 
+  // with the same tree, otherwise replace them (releasing the old ones)
+  bool same = tree == fTree and not fmap.empty();
+  if( same ){
+    for( auto& kv : fmap ) kv.second->UpdateFormulaLeaves();
+  }
+  else {
+    fmap.clear();
+    fTree = tree;
+    InitFormulae(tree);
+  }
+  if( not manager ) manager.reset(new TTreeFormulaManager());
+ 
+  // load formulae into manager and switch off non-used branches
+  // 25.05.21 mmlynari temporary workaround to read Aux and AuxDyn
+/*
+  tree->SetBranchStatus("*", 0);
+  for( auto& kv : fmap ){
+    manager->Add(kv.second.get());
+    // get set of all input branches
+    for(int i=0; i<kv.second->GetNcodes(); i++){
+      kv.second->GetLeaf(i)->GetBranch()->SetStatus(1);
+    } 
   }
-  fmap.clear();
-  //if( manager ) delete manager;
+*/
+  // sync the formulae so that all have the same number of entries per event 
+  manager->Sync();
 
-  manager = new TTreeFormulaManager();
+  // use bulk-read fast path for flat scalar trees (program is 
+  // kept if re-initialised with the same tree)
+  FlushBlock();
+  StopPipeline();
+  if( same and fprog ){
+    for( auto c : fprog->GetColumns() ) c->first = c->last = -1;
+    fBlockEnd = 0;
+  }
+  else {
+    fRecord.clear();
+    fUseBulk = fBulk and InitBulk();
+  }
 
+  //fIsInit = true;
+}
+void LokiSelector::InitFormulae(TTree *tree)
+{
   // load histogram formulae
   for ( LokiHist1D* h : hists1D ){
     h->fx = GetFormula(h->xvar, tree);
@@ -176,23 +545,18 @@ void LokiSelector::Init(TTree *tree)
     h->fsel = GetFormula(h->sel, tree);
     h->fwei = GetFormula(h->wei, tree);
   }
- 
-  // load formulae into manager and switch off non-used branches
-  // 25.05.21 mmlynari temporary workaround to read Aux and AuxDyn
-/*
-  tree->SetBranchStatus("*", 0);
-  for( auto& kv : fmap ){
-    manager->Add(kv.second);
-    // get set of all input branches
-    for(int i=0; i<kv.second->GetNcodes(); i++){
-      kv.second->GetLeaf(i)->GetBranch()->SetStatus(1);
-    } 
+  for ( LokiEff* e : effs ){
+    e->fx = GetFormula(e->xvar, tree);
+    e->fpass = GetFormula(e->sel_pass, tree);
+    e->ftotal = GetFormula(e->sel_total, tree);
+    e->fwei = GetFormula(e->wei, tree);
+  }
+  for ( LokiNtup* n : ntups ){
+    for( size_t i=0; i<n->vars.size(); i++ ) n->fvars[i] = GetFormula(n->vars[i], tree);
+    n->fsel = GetFormula(n->sel, tree);
+    n->fwei = GetFormula(n->wei, tree);
+    n->Book();
   }
-*/
-  // sync the formulae so that all have the same number of entries per event 
-  manager->Sync();
-
-  //fIsInit = true;
 }
 
 Bool_t LokiSelector::Notify()
@@ -203,6 +567,13 @@ Bool_t LokiSelector::Notify()
   // to the generated code, but the routine can be extended by the
   // user if needed. The return value is currently not used.
 
+  // baskets of the previous tree are no longer valid
+  FlushBlock();
+  StopPipeline();
+  if( fprog ){
+    for( auto c : fprog->GetColumns() ) c->first = c->last = -1;
+  }
+  fBlockEnd = 0;
   return kTRUE;
 }
 
@@ -0,0 +1,72 @@
+/**
+ * lokirun.cxx
+ * ~~~~~~~~~~~
+ * Standalone batch executor for loki selector jobs.
+ *
+ * Runs the LokiSelector jobs described in a job spec
+ * (see LokiJob.h), without python. Usage:
+ *
+ *   lokirun SPEC [INDEX ...]
+ *
+ * If INDEX is given, only the selectors with these
+ * indices are run (eg. one per batch array job),
+ * otherwise all selectors in the spec are run in
+ * sequence. For each completed selector a line of
+ * JSON statistics is printed to stdout. The exit
+ * code is non-zero if any job failed.
+ *
+ * Build via scripts/build_lokirun.sh.
+ *
+ * Author    : "Will Davey"
+ * Email     : "will.davey@cern.ch"
+ * Created   : 2017-02-22
+ * Copyright : "Copyright 2016 Will Davey"
+ * License   : "GPL http://www.gnu.org/licenses/gpl.html"
+ */
+#include "LokiJob.h"
+#include <TROOT.h>
+#include <cstdlib>
+#include <iostream>
+
+int main(int argc, char** argv)
+{
+  if( argc < 2 ){
+    std::cerr << "usage: lokirun SPEC [INDEX ...]" << std::endl;
+    return 2;
+  }
+  gROOT->SetBatch(kTRUE);
+
+  std::vector<std::unique_ptr<LokiJob> > jobs;
+  std::string err;
+  if( not LokiJob::Read(argv[1], jobs, err) ){
+    std::cerr << "lokirun: failed to read job spec " << argv[1] << ": " << err << std::endl;
+    return 2;
+  }
+
+  // select jobs
+  std::vector<size_t> indices;
+  for( int i=2; i<argc; i++ ){
+    long idx = strtol(argv[i], 0, 10);
+    if( idx < 0 or (size_t)idx >= jobs.size() ){
+      std::cerr << "lokirun: invalid job index " << argv[i] << std::endl;
+      return 2;
+    }
+    indices.push_back(idx);
+  }
+  if( indices.empty() ){
+    for( size_t i=0; i<jobs.size(); i++ ) indices.push_back(i);
+  }
+
+  // run
+  int status = 0;
+  for( size_t i : indices ){
+    if( jobs[i]->Run() ){
+      std::cout << jobs[i]->GetStats() << std::endl;
+    }
+    else {
+      std::cerr << "lokirun: job " << i << " failed (" << jobs[i]->fin << ")" << std::endl;
+      status = 1;
+    }
+  }
+  return status;
+}